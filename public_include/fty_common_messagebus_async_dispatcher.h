@@ -0,0 +1,197 @@
+/*  =========================================================================
+    fty_common_messagebus_async_dispatcher - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_COMMON_MESSAGEBUS_ASYNC_DISPATCHER_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_ASYNC_DISPATCHER_H_INCLUDED
+
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <utility>
+
+#include "fty_common_messagebus_dispatcher.h"
+#include "fty_common_messagebus_pool_worker.h"
+
+namespace messagebus {
+
+class StrandState;
+
+/**
+ * \brief Log an exception thrown by work offloaded without a future.
+ * \param exception Exception caught.
+ */
+void logOffloadFailure(std::exception_ptr exception);
+
+/**
+ * \brief Limit of the number of jobs running at once on a shared PoolWorker.
+ *
+ * Work posted beyond the limit waits in order, and is scheduled on the pool when a
+ * job of the limit is done. A limit of 1 is a Strand.
+ */
+class ConcurrencyLimit {
+public:
+    /**
+     * \brief Create a limit.
+     * \param pool Pool doing the work, must outlive the work posted.
+     * \param limit Maximum number of jobs running at once.
+     * \throw std::invalid_argument if limit is 0.
+     */
+    ConcurrencyLimit(PoolWorker& pool, size_t limit);
+    ~ConcurrencyLimit();
+
+    // ConcurrencyLimit can't be copied, assigned or moved.
+    ConcurrencyLimit(const ConcurrencyLimit&) = delete;
+    ConcurrencyLimit(ConcurrencyLimit&&) = delete;
+    ConcurrencyLimit& operator=(const ConcurrencyLimit&) = delete;
+    ConcurrencyLimit& operator=(ConcurrencyLimit&&) = delete;
+
+    /**
+     * \brief Post work.
+     *
+     * If the pool is being destroyed and doesn't accept work anymore, the work runs in
+     * the calling thread instead.
+     * \param work Work to do.
+     */
+    void post(WorkUnit&& work);
+
+private:
+    std::shared_ptr<StrandState> m_state;
+} ;
+
+/**
+ * \brief Callable dispatcher running the callables on a PoolWorker.
+ *
+ * Like Dispatcher, the callable is looked up by key (or the default handler is used),
+ * but it is called on the pool with copies of the arguments. Keys can be given a limit
+ * of calls running at once, the calls beyond it wait in order. The dispatcher must
+ * outlive the calls it scheduled. MapType is the same as Dispatcher's, pass a std::map
+ * with std::less<> to look keys of other types up without conversion.
+ */
+template <class KeyType, typename WorkFunctionType, typename MissingFunctionType, typename MapType = std::map<KeyType, WorkFunctionType>>
+class AsyncDispatcher {
+public:
+    /// \brief Map of (key -> callable).
+    using Map = MapType;
+    /// \brief Map of (key -> maximum number of calls running at once).
+    using Limits = std::map<KeyType, size_t, std::less<>>;
+    using ResultType = typename WorkFunctionType::result_type;
+
+    /**
+     * \brief Constructor.
+     * \param pool Pool running the callables, must outlive the dispatcher.
+     * \param map Function map.
+     * \param defaultHandler Default handler callable.
+     * \param limits Concurrency limits of keys, other keys are not limited.
+     * \throw std::invalid_argument if a limit is 0.
+     */
+    AsyncDispatcher(PoolWorker& pool, Map map, MissingFunctionType defaultHandler = MissingFunctionType(), const Limits& limits = Limits())
+        : m_pool(pool), m_map(std::move(map)), m_defaultHandler(std::move(defaultHandler)) {
+        for (const auto& limit : limits) {
+            m_limits.emplace(limit.first, std::unique_ptr<ConcurrencyLimit>(new ConcurrencyLimit(pool, limit.second)));
+        }
+    }
+
+    /**
+     * \brief Schedule the callable of a key (keep a std::future for the result).
+     * \param key Value to dispatch with.
+     * \param args Arguments to pass to the callable.
+     * \return A future of the result of the callable.
+     * \warning Dispatching an unknown key without a default handler will set an std::bad_function_call in the future.
+     */
+    template <typename LookupKeyType, typename... ArgsType>
+    std::future<ResultType> schedule(const LookupKeyType& key, ArgsType&&... args) {
+        std::packaged_task<ResultType()> task(bind(key, std::forward<ArgsType>(args)...));
+        auto future = task.get_future();
+        post(key, std::move(task));
+        return future;
+    }
+
+    /**
+     * \brief Offload the callable of a key (do not keep a std::future for the result).
+     *
+     * Exceptions thrown by the callable, or by dispatching an unknown key without a
+     * default handler, are logged.
+     * \param key Value to dispatch with.
+     * \param args Arguments to pass to the callable.
+     */
+    template <typename LookupKeyType, typename... ArgsType>
+    void offload(const LookupKeyType& key, ArgsType&&... args) {
+        post(key, [call = bind(key, std::forward<ArgsType>(args)...)]() mutable {
+            try {
+                call();
+            }
+            catch (...) {
+                logOffloadFailure(std::current_exception());
+            }
+        });
+    }
+
+private:
+    // Resolve the callable now, and bind copies of the arguments to call it later.
+    template <typename LookupKeyType, typename... ArgsType>
+    auto bind(const LookupKeyType& key, ArgsType&&... args) {
+        auto it = find(key, 0);
+        const WorkFunctionType* work = it != m_map.end() ? &it->second : nullptr;
+        return [this, work, missing = work ? KeyType() : KeyType(key), args = std::make_tuple(std::forward<ArgsType>(args)...)]() mutable -> ResultType {
+            if (work) {
+                return std::apply(*work, std::move(args));
+            }
+            return std::apply([this, &missing](auto&&... values) -> ResultType {
+                return m_defaultHandler(missing, std::forward<decltype(values)>(values)...);
+            }, std::move(args));
+        };
+    }
+
+    template <typename LookupKeyType, typename Call>
+    void post(const LookupKeyType& key, Call&& call) {
+        if (!m_limits.empty()) {
+            auto limit = m_limits.find(key);
+            if (limit != m_limits.end()) {
+                limit->second->post(WorkUnit(std::forward<Call>(call)));
+                return;
+            }
+        }
+        m_pool.offload(std::forward<Call>(call));
+    }
+
+    // Look the key up as is if the map accepts it, otherwise convert it.
+    template <typename LookupKeyType>
+    auto find(const LookupKeyType& key, int) -> decltype(std::declval<Map&>().find(key)) {
+        return m_map.find(key);
+    }
+
+    template <typename LookupKeyType>
+    auto find(const LookupKeyType& key, long) {
+        return m_map.find(KeyType(key));
+    }
+
+    PoolWorker& m_pool;
+    Map m_map;
+    MissingFunctionType m_defaultHandler;
+    std::map<KeyType, std::unique_ptr<ConcurrencyLimit>, std::less<>> m_limits;
+} ;
+
+}
+
+#endif
@@ -22,32 +22,262 @@
 #ifndef FTY_COMMON_MESSAGEBUS_DISPATCHER_H_INCLUDED
 #define FTY_COMMON_MESSAGEBUS_DISPATCHER_H_INCLUDED
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <functional>
+#include <initializer_list>
 #include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace messagebus {
 
+/// \brief Hash of dispatcher keys, same as std::hash.
+template <class KeyType>
+struct KeyHash : std::hash<KeyType> { } ;
+
+/// \brief Hash of std::string keys, also hashes std::string_view or const char* lookups without allocation.
+template <>
+struct KeyHash<std::string> {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view key) const noexcept {
+        return std::hash<std::string_view>()(key);
+    }
+} ;
+
 /**
- * \brief Callable dispatcher based on std::map.
+ * \brief Immutable map with a perfect hash function, built once at construction.
+ *
+ * Keys are spread into buckets by hash, then each bucket gets a seed such that all its
+ * keys land in distinct slots (hash and displace). A lookup hashes the key once, reads
+ * the seed of its bucket, and compares the key found in its slot. If Hash is transparent
+ * (like KeyHash<std::string>), find() also accepts keys of other types hashing the same.
  */
-template <class KeyType, typename WorkFunctionType, typename MissingFunctionType>
+template <class KeyType, typename ValueType, typename Hash = KeyHash<KeyType>, typename KeyEqual = std::equal_to<>>
+class PerfectHashMap {
+public:
+    using key_type = KeyType;
+    using mapped_type = ValueType;
+    using value_type = std::pair<const KeyType, ValueType>;
+    using const_iterator = const value_type*;
+    using iterator = const_iterator;
+
+    PerfectHashMap() : PerfectHashMap(std::initializer_list<value_type>()) { }
+
+    PerfectHashMap(std::initializer_list<value_type> values) : PerfectHashMap(values.begin(), values.end()) { }
+
+    /**
+     * \brief Build the map.
+     * \param first First (key, value) pair.
+     * \param last Past the last (key, value) pair.
+     * \throw std::invalid_argument if keys are not unique.
+     */
+    template <typename InputIterator>
+    PerfectHashMap(InputIterator first, InputIterator last) {
+        for (; first != last; ++first) {
+            m_entries.emplace_back(*first);
+        }
+        build();
+    }
+
+    const_iterator begin() const {
+        return m_entries.data();
+    }
+
+    const_iterator end() const {
+        return m_entries.data() + m_entries.size();
+    }
+
+    size_t size() const {
+        return m_entries.size();
+    }
+
+    bool empty() const {
+        return m_entries.empty();
+    }
+
+    const_iterator find(const KeyType& key) const {
+        return lookup(key);
+    }
+
+    template <typename LookupKeyType, typename HashType = Hash, typename = typename HashType::is_transparent>
+    const_iterator find(const LookupKeyType& key) const {
+        return lookup(key);
+    }
+
+    size_t count(const KeyType& key) const {
+        return find(key) != end() ? 1 : 0;
+    }
+
+    const ValueType& at(const KeyType& key) const {
+        auto it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("PerfectHashMap::at");
+        }
+        return it->second;
+    }
+
+private:
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+    static constexpr uint32_t MAX_SEED = 1u << 20;
+    // Times the table may double in size when seeds can't be found, before giving up.
+    static constexpr unsigned MAX_GROWTH = 4;
+
+    template <typename LookupKeyType>
+    const_iterator lookup(const LookupKeyType& key) const {
+        if (m_entries.empty()) {
+            return end();
+        }
+
+        uint64_t hash = uint64_t(Hash()(key));
+        uint32_t index = m_slots[slot(hash, m_seeds[bucket(hash, m_seeds.size())])];
+        if (index != EMPTY && KeyEqual()(m_entries[index].first, key)) {
+            return &m_entries[index];
+        }
+        return end();
+    }
+
+    // SplitMix64 finalizer, so that even poor hashes (like identity on integers) are scrambled.
+    static uint64_t mix(uint64_t hash, uint64_t seed) {
+        uint64_t z = hash + (seed + 1) * 0x9e3779b97f4a7c15ull;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    static size_t bucket(uint64_t hash, size_t bucketCount) {
+        // A fixed seed out of the range of slot seeds.
+        return size_t(mix(hash, MAX_SEED) & (bucketCount - 1));
+    }
+
+    size_t slot(uint64_t hash, uint32_t seed) const {
+        return size_t(mix(hash, seed) & (m_slots.size() - 1));
+    }
+
+    void build() {
+        if (m_entries.empty()) {
+            return;
+        }
+
+        // Keys are only told apart by their hash, look for duplicates among equal hashes.
+        std::vector<std::pair<uint64_t, size_t>> sorted;
+        for (size_t index = 0; index < m_entries.size(); index++) {
+            sorted.emplace_back(uint64_t(Hash()(m_entries[index].first)), index);
+        }
+        std::sort(sorted.begin(), sorted.end());
+        for (size_t cpt = 1; cpt < sorted.size(); cpt++) {
+            if (sorted[cpt].first == sorted[cpt - 1].first) {
+                bool duplicate = KeyEqual()(m_entries[sorted[cpt].second].first, m_entries[sorted[cpt - 1].second].first);
+                throw std::invalid_argument(duplicate ? "PerfectHashMap keys must be unique" : "PerfectHashMap keys must have distinct hashes");
+            }
+        }
+
+        // Start with a power of two table at least as large as the key set, grow if seeds can't be found.
+        size_t tableSize = 1;
+        while (tableSize < m_entries.size()) {
+            tableSize *= 2;
+        }
+        for (unsigned growth = 0; !tryBuild(tableSize); growth++) {
+            if (growth == MAX_GROWTH) {
+                throw std::runtime_error("PerfectHashMap could not find a perfect hash for its keys");
+            }
+            tableSize *= 2;
+        }
+    }
+
+    bool tryBuild(size_t tableSize) {
+        std::vector<uint64_t> hashes;
+        for (const auto& entry : m_entries) {
+            hashes.push_back(uint64_t(Hash()(entry.first)));
+        }
+
+        // About 2 keys per bucket, largest buckets are placed first while the table is still empty.
+        size_t bucketCount = 1;
+        while (bucketCount * 2 < m_entries.size()) {
+            bucketCount *= 2;
+        }
+        std::vector<std::vector<uint32_t>> buckets(bucketCount);
+        for (uint32_t index = 0; index < m_entries.size(); index++) {
+            buckets[bucket(hashes[index], bucketCount)].push_back(index);
+        }
+        std::vector<size_t> order(buckets.size());
+        for (size_t bucket = 0; bucket < buckets.size(); bucket++) {
+            order[bucket] = bucket;
+        }
+        std::stable_sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+        m_slots.assign(tableSize, uint32_t(EMPTY));
+        m_seeds.assign(buckets.size(), 0);
+        std::vector<size_t> taken;
+        for (size_t bucket : order) {
+            if (buckets[bucket].empty()) {
+                break;
+            }
+
+            uint32_t seed = 0;
+            for (; seed < MAX_SEED; seed++) {
+                taken.clear();
+                for (uint32_t index : buckets[bucket]) {
+                    size_t candidate = slot(hashes[index], seed);
+                    if (m_slots[candidate] != EMPTY || std::find(taken.begin(), taken.end(), candidate) != taken.end()) {
+                        break;
+                    }
+                    taken.push_back(candidate);
+                }
+                if (taken.size() == buckets[bucket].size()) {
+                    break;
+                }
+            }
+            if (seed == MAX_SEED) {
+                return false;
+            }
+
+            m_seeds[bucket] = seed;
+            for (size_t cpt = 0; cpt < taken.size(); cpt++) {
+                m_slots[taken[cpt]] = buckets[bucket][cpt];
+            }
+        }
+        return true;
+    }
+
+    std::vector<value_type> m_entries;
+    std::vector<uint32_t> m_slots;
+    std::vector<uint32_t> m_seeds;
+} ;
+
+/**
+ * \brief Callable dispatcher based on a map (std::map by default).
+ *
+ * MapType must provide find() and end(), see HashDispatcher, TransparentDispatcher and
+ * PerfectHashDispatcher. Keys of other types (like a const char* subject for std::string
+ * keys) are looked up without conversion when the map supports it: std::map with
+ * std::less<> and PerfectHashMap do, the default std::map and std::unordered_map don't.
+ */
+template <class KeyType, typename WorkFunctionType, typename MissingFunctionType, typename MapType = std::map<KeyType, WorkFunctionType>>
 class Dispatcher {
 public:
     /// \brief Map of (key -> callable).
-    using Map = std::map<KeyType, WorkFunctionType>;
+    using Map = MapType;
 
     /**
      * \brief Constructor without default handler.
      * \param map Function map.
      */
-    Dispatcher(Map map) : Dispatcher(map, MissingFunctionType()) { }
+    Dispatcher(Map map) : Dispatcher(std::move(map), MissingFunctionType()) { }
 
     /**
      * \brief Constructor with default handler.
      * \param map Function map.
      * \param defaultHandler Default handler callable.
      */
-    Dispatcher(Map map, MissingFunctionType defaultHandler) : m_map(map), m_defaultHandler(defaultHandler) { }
+    Dispatcher(Map map, MissingFunctionType defaultHandler) : m_map(std::move(map)), m_defaultHandler(std::move(defaultHandler)) { }
 
     /**
      * \brief Dispatch a callable based on a key.
@@ -58,18 +288,219 @@ public:
      */
     template <typename... ArgsType>
     typename WorkFunctionType::result_type operator()(const KeyType& key, ArgsType&&... args) {
-        auto it = m_map.find(key);
+        return dispatch(key, std::forward<ArgsType>(args)...);
+    }
+
+    /**
+     * \brief Dispatch a callable based on a key of another type (like const char* or std::string_view).
+     *
+     * The key is only converted to KeyType if the map can't look it up as is, or for the
+     * default handler.
+     */
+    template <typename LookupKeyType, typename... ArgsType>
+    typename WorkFunctionType::result_type operator()(const LookupKeyType& key, ArgsType&&... args) {
+        return dispatch(key, std::forward<ArgsType>(args)...);
+    }
+
+    /**
+     * \brief Whether dispatching a key would call a callable.
+     * \param key Value to dispatch with.
+     * \return true if the key is in the map, or if there is a default handler.
+     */
+    template <typename LookupKeyType>
+    bool canDispatch(const LookupKeyType& key) {
+        return find(key, 0) != m_map.end() || hasDefaultHandler();
+    }
+
+private:
+    bool hasDefaultHandler() const {
+        if constexpr (std::is_constructible<bool, const MissingFunctionType&>::value) {
+            return bool(m_defaultHandler);
+        }
+        else {
+            return true;
+        }
+    }
+
+    template <typename LookupKeyType, typename... ArgsType>
+    typename WorkFunctionType::result_type dispatch(const LookupKeyType& key, ArgsType&&... args) {
+        auto it = find(key, 0);
         if (it != m_map.end()) {
             return it->second(std::forward<ArgsType>(args)...);
         }
+        return m_defaultHandler(toKey(key), std::forward<ArgsType>(args)...);
+    }
+
+    // Look the key up as is if the map accepts it, otherwise convert it.
+    template <typename LookupKeyType>
+    auto find(const LookupKeyType& key, int) -> decltype(std::declval<Map&>().find(key)) {
+        return m_map.find(key);
+    }
+
+    template <typename LookupKeyType>
+    auto find(const LookupKeyType& key, long) {
+        return m_map.find(toKey(key));
+    }
+
+    static const KeyType& toKey(const KeyType& key) {
+        return key;
+    }
+
+    template <typename LookupKeyType>
+    static KeyType toKey(const LookupKeyType& key) {
+        return KeyType(key);
+    }
+
+    Map m_map;
+    MissingFunctionType m_defaultHandler;
+} ;
+
+/// \brief Callable dispatcher based on std::map with std::less<>, looking keys of other types up without conversion.
+template <class KeyType, typename WorkFunctionType, typename MissingFunctionType>
+using TransparentDispatcher = Dispatcher<KeyType, WorkFunctionType, MissingFunctionType, std::map<KeyType, WorkFunctionType, std::less<>>>;
+
+/// \brief Callable dispatcher based on std::unordered_map.
+template <class KeyType, typename WorkFunctionType, typename MissingFunctionType>
+using HashDispatcher = Dispatcher<KeyType, WorkFunctionType, MissingFunctionType, std::unordered_map<KeyType, WorkFunctionType>>;
+
+/// \brief Callable dispatcher based on an immutable PerfectHashMap.
+template <class KeyType, typename WorkFunctionType, typename MissingFunctionType>
+using PerfectHashDispatcher = Dispatcher<KeyType, WorkFunctionType, MissingFunctionType, PerfectHashMap<KeyType, WorkFunctionType>>;
+
+/**
+ * \brief Key of a StaticDispatcher, a string literal hashed at compile time.
+ */
+class StaticKey {
+public:
+    template <size_t N>
+    constexpr StaticKey(const char (&literal)[N]) : m_key(literal, N - 1), m_hash(hash(m_key)) { }
+
+    constexpr explicit StaticKey(std::string_view key) : m_key(key), m_hash(hash(key)) { }
+
+    constexpr std::string_view view() const {
+        return m_key;
+    }
+
+    constexpr uint64_t hash() const {
+        return m_hash;
+    }
+
+    /// \brief FNV-1a hash of a key, mixed with its length.
+    static constexpr uint64_t hash(std::string_view key) {
+        uint64_t value = 0xcbf29ce484222325ull ^ key.size();
+        for (char c : key) {
+            value = (value ^ uint8_t(c)) * 0x100000001b3ull;
+        }
+        return value;
+    }
+
+private:
+    std::string_view m_key;
+    uint64_t m_hash;
+} ;
+
+/// \brief Route of a StaticDispatcher.
+template <typename WorkFunctionType>
+struct StaticRoute {
+    StaticKey key;
+    WorkFunctionType work;
+} ;
+
+/**
+ * \brief Callable dispatcher for a set of keys known at compile time.
+ *
+ * Routes are kept sorted by hash in a fixed size array, a lookup hashes the key, binary
+ * searches its hash and compares the key found. Nothing is allocated, and with function
+ * pointers as callables the whole dispatcher can be constexpr.
+ */
+template <typename WorkFunctionType, typename MissingFunctionType, size_t N>
+class StaticDispatcher {
+public:
+    using Route = StaticRoute<WorkFunctionType>;
+
+    /**
+     * \brief Constructor.
+     * \param routes Keys and callables.
+     * \param defaultHandler Default handler callable.
+     * \throw std::invalid_argument if keys are not unique (at compile time if constexpr).
+     */
+    constexpr StaticDispatcher(const std::array<Route, N>& routes, MissingFunctionType defaultHandler = MissingFunctionType())
+        : m_routes(routes), m_defaultHandler(defaultHandler) {
+        // Insertion sort, also constexpr.
+        for (size_t i = 1; i < N; i++) {
+            for (size_t j = i; j > 0 && m_routes[j].key.hash() < m_routes[j - 1].key.hash(); j--) {
+                Route route     = m_routes[j];
+                m_routes[j]     = m_routes[j - 1];
+                m_routes[j - 1] = route;
+            }
+        }
+        for (size_t i = 1; i < N; i++) {
+            if (m_routes[i].key.hash() == m_routes[i - 1].key.hash()) {
+                throw std::invalid_argument("StaticDispatcher keys must be unique");
+            }
+        }
+    }
+
+    /**
+     * \brief Dispatch a callable based on a key.
+     * \param key Value to dispatch with.
+     * \param args Arguments to pass to the callable.
+     * \return Result of callable.
+     * \warning Dispatching an unknown key without a default handler will throw an std::bad_function_call.
+     */
+    template <typename... ArgsType>
+    constexpr decltype(auto) operator()(std::string_view key, ArgsType&&... args) const {
+        const uint64_t hash = StaticKey::hash(key);
+
+        size_t first = 0;
+        size_t last  = N;
+        while (first < last) {
+            size_t middle = first + (last - first) / 2;
+            if (m_routes[middle].key.hash() < hash) {
+                first = middle + 1;
+            }
+            else {
+                last = middle;
+            }
+        }
+        if (first < N && m_routes[first].key.hash() == hash && m_routes[first].key.view() == key) {
+            return m_routes[first].work(std::forward<ArgsType>(args)...);
+        }
+
+        if constexpr (std::is_pointer<MissingFunctionType>::value) {
+            if (!m_defaultHandler) {
+                throw std::bad_function_call();
+            }
+        }
         return m_defaultHandler(key, std::forward<ArgsType>(args)...);
     }
 
+    constexpr size_t size() const {
+        return N;
+    }
+
 private:
-    Map m_map;
+    std::array<Route, N> m_routes;
     MissingFunctionType m_defaultHandler;
 } ;
 
+/**
+ * \brief Make a StaticDispatcher, deducing the number of routes.
+ * \param routes Keys and callables, as { { "key", callable }, ... }.
+ * \param defaultHandler Default handler callable.
+ */
+template <typename WorkFunctionType, typename MissingFunctionType, size_t N, size_t... I>
+constexpr StaticDispatcher<WorkFunctionType, MissingFunctionType, N> makeStaticDispatcher(
+    const StaticRoute<WorkFunctionType> (&routes)[N], MissingFunctionType defaultHandler, std::index_sequence<I...>) {
+    return StaticDispatcher<WorkFunctionType, MissingFunctionType, N>({ { routes[I]... } }, defaultHandler);
+}
+
+template <typename WorkFunctionType, typename MissingFunctionType, size_t N>
+constexpr StaticDispatcher<WorkFunctionType, MissingFunctionType, N> makeStaticDispatcher(
+    const StaticRoute<WorkFunctionType> (&routes)[N], MissingFunctionType defaultHandler) {
+    return makeStaticDispatcher(routes, defaultHandler, std::make_index_sequence<N>());
+}
+
 }
 
 #endif
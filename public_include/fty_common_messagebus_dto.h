@@ -23,6 +23,9 @@
 
 #include <string>
 #include <list>
+#include <tuple>
+
+#include "fty_common_messagebus_serialization.h"
 
 namespace messagebus {
     using UserData = std::list<std::string>;
@@ -33,6 +36,12 @@ struct FooBar {
     std::string bar;
     FooBar() = default;
     FooBar(const std::string& _foo, const std::string& _bar) : foo(_foo), bar(_bar) { }
+
+    // Binary encoding with messagebus::encode()/decode(), opt-in: the UserData
+    // operators keep sending foo and bar as two string frames.
+    static constexpr auto fields() {
+        return std::make_tuple(&FooBar::foo, &FooBar::bar);
+    }
 };
 
 void operator<< (messagebus::UserData& data, const FooBar& object);
@@ -0,0 +1,471 @@
+/*  =========================================================================
+    fty_common_messagebus_future - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_COMMON_MESSAGEBUS_FUTURE_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_FUTURE_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fty_common_messagebus_pool_worker.h"
+
+namespace messagebus {
+
+/**
+ * \brief Shared state between a Future and the work producing its value.
+ *
+ * Holds the value or the exception of the work, and at most one callback run once either is set.
+ */
+template <typename T>
+class FutureState {
+public:
+    FutureState() = default;
+    FutureState(const FutureState&) = delete;
+    FutureState& operator=(const FutureState&) = delete;
+
+    ~FutureState() {
+        if (m_hasValue) {
+            reinterpret_cast<Stored*>(&m_storage)->~Stored();
+        }
+    }
+
+    /**
+     * \brief Set the value, then run the callback if any.
+     * \param value Arguments to construct the value with (none if T is void).
+     */
+    template <typename... Value>
+    void setValue(Value&&... value) {
+        WorkUnit callback;
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            new (&m_storage) Stored(std::forward<Value>(value)...);
+            m_hasValue = true;
+            m_ready    = true;
+            callback   = std::move(m_callback);
+            m_cv.notify_all();
+        }
+        if (callback) {
+            callback();
+        }
+    }
+
+    /**
+     * \brief Set the exception, then run the callback if any.
+     * \param error Exception of the work.
+     */
+    void setException(std::exception_ptr error) {
+        WorkUnit callback;
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_error  = error;
+            m_ready  = true;
+            callback = std::move(m_callback);
+            m_cv.notify_all();
+        }
+        if (callback) {
+            callback();
+        }
+    }
+
+    /**
+     * \brief Set the result of a call, the value it returns or the exception it throws.
+     * \param call Callable returning the value.
+     */
+    template <typename Call>
+    void fulfill(Call& call) {
+        try {
+            fulfill(call, std::is_void<T>());
+        }
+        catch (...) {
+            setException(std::current_exception());
+        }
+    }
+
+    /**
+     * \brief Run a callback once the value or the exception is set.
+     *
+     * The callback runs in the thread setting the value, or right away if it is already set.
+     * \param callback Callback to run, must not throw.
+     */
+    void onReady(WorkUnit&& callback) {
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            if (!m_ready) {
+                m_callback = std::move(callback);
+                return;
+            }
+        }
+        callback();
+    }
+
+    bool ready() const {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        return m_ready;
+    }
+
+    void wait() const {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_cv.wait(lk, [this]() { return m_ready; });
+    }
+
+    /**
+     * \brief Wait for and take the value (only once).
+     * \return The value.
+     * \throw The exception of the work, if it failed.
+     */
+    T take() {
+        wait();
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+        return static_cast<T>(std::move(*reinterpret_cast<Stored*>(&m_storage)));
+    }
+
+private:
+    using Stored = typename std::conditional<std::is_void<T>::value, char, T>::type;
+
+    template <typename Call>
+    void fulfill(Call& call, std::false_type) {
+        setValue(call());
+    }
+
+    template <typename Call>
+    void fulfill(Call& call, std::true_type) {
+        call();
+        setValue();
+    }
+
+    mutable std::mutex m_mutex;
+    mutable std::condition_variable m_cv;
+    bool m_ready = false;
+    bool m_hasValue = false;
+    typename std::aligned_storage<sizeof(Stored), alignof(Stored)>::type m_storage;
+    std::exception_ptr m_error;
+    WorkUnit m_callback;
+} ;
+
+/// \brief Call of a continuation with the value of a FutureState.
+template <typename Function, typename T>
+struct FutureContinuation {
+    using Result = decltype(std::declval<Function&>()(std::declval<T&&>()));
+
+    static Result call(Function& fn, FutureState<T>& state) {
+        return fn(state.take());
+    }
+} ;
+
+template <typename Function>
+struct FutureContinuation<Function, void> {
+    using Result = decltype(std::declval<Function&>()());
+
+    static Result call(Function& fn, FutureState<void>& state) {
+        state.take();
+        return fn();
+    }
+} ;
+
+/// \brief Result of whenAll(): the values, in order.
+template <typename T>
+struct WhenAllResult {
+    using Type = std::vector<T>;
+
+    static Type collect(std::vector<std::shared_ptr<FutureState<T>>>& states) {
+        Type values;
+        values.reserve(states.size());
+        for (auto& state : states) {
+            values.push_back(state->take());
+        }
+        return values;
+    }
+} ;
+
+template <>
+struct WhenAllResult<void> {
+    using Type = void;
+
+    static void collect(std::vector<std::shared_ptr<FutureState<void>>>& states) {
+        for (auto& state : states) {
+            state->take();
+        }
+    }
+} ;
+
+/// \brief Result of whenAny(): the index of the first future ready, and its value.
+template <typename T>
+struct WhenAnyResult {
+    using Type = std::pair<size_t, T>;
+
+    static Type take(size_t index, FutureState<T>& state) {
+        return Type(index, state.take());
+    }
+} ;
+
+template <>
+struct WhenAnyResult<void> {
+    using Type = size_t;
+
+    static Type take(size_t index, FutureState<void>& state) {
+        state.take();
+        return index;
+    }
+} ;
+
+template <typename T>
+class Future;
+
+template <typename T>
+Future<typename WhenAllResult<T>::Type> whenAll(PoolWorker& pool, std::vector<Future<T>>&& futures);
+
+template <typename T>
+Future<typename WhenAnyResult<T>::Type> whenAny(PoolWorker& pool, std::vector<Future<T>>&& futures);
+
+/**
+ * \brief Result of work done by a PoolWorker, which can be chained without blocking.
+ *
+ * Unlike std::future, continuations are scheduled on the pool once the value is ready,
+ * no thread blocks waiting for it. A Future has a single consumer: get(), then(),
+ * whenAll() and whenAny() consume it.
+ */
+template <typename T>
+class Future {
+public:
+    Future() = default;
+
+    /**
+     * \brief Create a future.
+     * \param pool Pool running the continuations.
+     * \param state Shared state of the value.
+     */
+    Future(PoolWorker* pool, std::shared_ptr<FutureState<T>> state) : m_pool(pool), m_state(std::move(state)) { }
+
+    Future(Future&&) = default;
+    Future& operator=(Future&&) = default;
+    Future(const Future&) = delete;
+    Future& operator=(const Future&) = delete;
+
+    /// \return Whether the future has a value to consume.
+    bool valid() const {
+        return bool(m_state);
+    }
+
+    /// \return Whether the value or the exception is set.
+    bool ready() const {
+        return state().ready();
+    }
+
+    /// \brief Wait until the value or the exception is set.
+    void wait() const {
+        state().wait();
+    }
+
+    /**
+     * \brief Wait for and get the value.
+     * \return The value.
+     * \throw The exception of the work, if it failed.
+     */
+    T get() {
+        auto st = std::move(m_state);
+        if (!st) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        return st->take();
+    }
+
+    /**
+     * \brief Chain work once the value is ready.
+     *
+     * The continuation is scheduled on the pool with the value (nothing if T is void). If the
+     * work failed, the continuation is skipped and the returned future holds the exception.
+     * \param fn Callable of the continuation.
+     * \return A future of the return value of the continuation.
+     */
+    template <
+        typename Function,
+        typename Result = typename FutureContinuation<typename std::decay<Function>::type, T>::Result
+    >
+    Future<Result> then(Function&& fn) {
+        using Continuation = typename std::decay<Function>::type;
+
+        state(); // Throws if consumed.
+        auto        previous = std::move(m_state);
+        auto        next     = std::make_shared<FutureState<Result>>();
+        PoolWorker* pool     = m_pool;
+
+        previous->onReady(WorkUnit([pool, previous, next, fn = Continuation(std::forward<Function>(fn))]() mutable {
+            try {
+                pool->offload([previous, next, fn = std::move(fn)]() mutable {
+                    auto call = [&]() { return FutureContinuation<Continuation, T>::call(fn, *previous); };
+                    next->fulfill(call);
+                });
+            }
+            catch (...) {
+                // Pool terminated.
+                next->setException(std::current_exception());
+            }
+        }));
+
+        return Future<Result>(pool, next);
+    }
+
+private:
+    FutureState<T>& state() const {
+        if (!m_state) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        return *m_state;
+    }
+
+    template <typename U>
+    friend Future<typename WhenAllResult<U>::Type> whenAll(PoolWorker& pool, std::vector<Future<U>>&& futures);
+
+    template <typename U>
+    friend Future<typename WhenAnyResult<U>::Type> whenAny(PoolWorker& pool, std::vector<Future<U>>&& futures);
+
+    PoolWorker* m_pool = nullptr;
+    std::shared_ptr<FutureState<T>> m_state;
+} ;
+
+/// \brief Work fulfilling a FutureState.
+template <typename T>
+struct FutureFulfiller {
+    std::shared_ptr<FutureState<T>> state;
+
+    template <typename Function, typename... Args>
+    void operator()(Function&& fn, Args&&... args) {
+        auto call = [&]() -> T { return fn(std::forward<Args>(args)...); };
+        state->fulfill(call);
+    }
+} ;
+
+/**
+ * \brief Schedule work on a pool (keep a Future for the result).
+ * \param pool Pool doing the work.
+ * \param fn Callable of the work to do.
+ * \param args Arguments to pass to the callable.
+ * \return A future of the return value of the callable.
+ */
+template <
+    typename Function,
+    typename... Args,
+    typename ReturnType = decltype(std::declval<Function&&>()(std::declval<Args&&>()...))
+>
+Future<ReturnType> async(PoolWorker& pool, Function&& fn, Args&&... args) {
+    auto state = std::make_shared<FutureState<ReturnType>>();
+    pool.offload(FutureFulfiller<ReturnType>{state}, std::forward<Function>(fn), std::forward<Args>(args)...);
+    return Future<ReturnType>(&pool, state);
+}
+
+/**
+ * \brief Wait for all futures without blocking.
+ * \param pool Pool running the continuations of the result.
+ * \param futures Futures to wait for, consumed.
+ * \return A future of the values in order (nothing if T is void), or of the exception of the first failed future.
+ */
+template <typename T>
+Future<typename WhenAllResult<T>::Type> whenAll(PoolWorker& pool, std::vector<Future<T>>&& futures) {
+    using Result = typename WhenAllResult<T>::Type;
+
+    struct Join {
+        std::vector<std::shared_ptr<FutureState<T>>> states;
+        std::shared_ptr<FutureState<Result>>         result;
+        std::atomic<size_t>                          remaining;
+    } ;
+
+    auto join = std::make_shared<Join>();
+    join->result = std::make_shared<FutureState<Result>>();
+    for (auto& future : futures) {
+        future.state();
+        join->states.push_back(std::move(future.m_state));
+    }
+    join->remaining = join->states.size();
+
+    auto collect = [join]() { return WhenAllResult<T>::collect(join->states); };
+    if (join->states.empty()) {
+        join->result->fulfill(collect);
+    }
+
+    // The last future ready collects them all.
+    for (auto& state : join->states) {
+        state->onReady(WorkUnit([join, collect]() mutable {
+            if (join->remaining.fetch_sub(1) == 1) {
+                join->result->fulfill(collect);
+            }
+        }));
+    }
+
+    return Future<Result>(&pool, join->result);
+}
+
+/**
+ * \brief Wait for the first future ready without blocking.
+ * \param pool Pool running the continuations of the result.
+ * \param futures Futures to wait for, consumed.
+ * \return A future of the index and value of the first future ready (only the index if T is void), or of its exception.
+ * \throw std::invalid_argument if there is no future to wait for.
+ */
+template <typename T>
+Future<typename WhenAnyResult<T>::Type> whenAny(PoolWorker& pool, std::vector<Future<T>>&& futures) {
+    using Result = typename WhenAnyResult<T>::Type;
+
+    if (futures.empty()) {
+        throw std::invalid_argument("No future to wait for");
+    }
+
+    struct Race {
+        std::shared_ptr<FutureState<Result>> result;
+        std::atomic_bool                     done;
+    } ;
+
+    auto race = std::make_shared<Race>();
+    race->result = std::make_shared<FutureState<Result>>();
+    race->done   = false;
+
+    std::vector<std::shared_ptr<FutureState<T>>> states;
+    for (auto& future : futures) {
+        future.state();
+        states.push_back(std::move(future.m_state));
+    }
+
+    for (size_t index = 0; index < states.size(); index++) {
+        auto state = states[index];
+        state->onReady(WorkUnit([race, state, index]() {
+            if (!race->done.exchange(true)) {
+                auto take = [&]() { return WhenAnyResult<T>::take(index, *state); };
+                race->result->fulfill(take);
+            }
+        }));
+    }
+
+    return Future<Result>(&pool, race->result);
+}
+
+}
+
+#endif
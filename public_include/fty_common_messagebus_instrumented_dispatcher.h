@@ -0,0 +1,192 @@
+/*  =========================================================================
+    fty_common_messagebus_instrumented_dispatcher - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_COMMON_MESSAGEBUS_INSTRUMENTED_DISPATCHER_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_INSTRUMENTED_DISPATCHER_H_INCLUDED
+
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "fty_common_messagebus_dispatcher.h"
+#include "fty_common_messagebus_pool_worker.h"
+
+namespace messagebus {
+
+class DispatchMetricsState;
+
+/// \brief Activity of a key of an InstrumentedDispatcher.
+struct DispatchStats {
+    uint64_t calls = 0;
+    /// Calls which threw.
+    uint64_t errors = 0;
+    /// Time spent in the callable.
+    PoolWorker::Histogram latency;
+} ;
+
+/**
+ * \brief Counters of the calls of a set of keys.
+ *
+ * Counters are relaxed atomics, one cache line apart per key so that hot keys
+ * don't slow down the others.
+ */
+class DispatchMetrics {
+public:
+    /**
+     * \brief Create counters.
+     * \param keys Number of keys.
+     */
+    explicit DispatchMetrics(size_t keys);
+    ~DispatchMetrics();
+
+    DispatchMetrics(const DispatchMetrics&) = delete;
+    DispatchMetrics& operator=(const DispatchMetrics&) = delete;
+
+    /**
+     * \brief Record a call.
+     * \param key Index of the key.
+     * \param latency Time spent in the callable.
+     * \param error Whether the callable threw.
+     */
+    void record(size_t key, std::chrono::nanoseconds latency, bool error);
+
+    /**
+     * \brief Activity of a key.
+     * \param key Index of the key.
+     */
+    DispatchStats stats(size_t key) const;
+
+private:
+    std::unique_ptr<DispatchMetricsState> m_state;
+} ;
+
+/**
+ * \brief Callable dispatcher recording the calls, errors and latency of each key.
+ *
+ * A Dispatcher with the same MapType (std::map by default), whose callables are wrapped
+ * to be timed, plus snapshot(). Calls of the default handler (unknown keys) are recorded
+ * together. WorkFunctionType and MissingFunctionType must be constructible from a
+ * lambda, like std::function.
+ */
+template <class KeyType, typename WorkFunctionType, typename MissingFunctionType, typename MapType = std::map<KeyType, WorkFunctionType>>
+class InstrumentedDispatcher {
+public:
+    /// \brief Map of (key -> callable).
+    using Map = MapType;
+    using ResultType = typename WorkFunctionType::result_type;
+
+    /// \brief Activity of the dispatcher, since its creation.
+    struct Snapshot {
+        std::map<KeyType, DispatchStats> keys;
+        /// Calls of the default handler.
+        DispatchStats missing;
+    } ;
+
+    /**
+     * \brief Constructor.
+     * \param map Function map.
+     * \param defaultHandler Default handler callable.
+     */
+    InstrumentedDispatcher(Map map, MissingFunctionType defaultHandler = MissingFunctionType())
+        : m_metrics(map.size() + 1)
+        , m_dispatcher(instrument(map), MissingFunctionType([metrics = &m_metrics, index = map.size(), handler = std::move(defaultHandler)](auto&&... args) -> ResultType {
+            Timer timer(*metrics, index);
+            return handler(std::forward<decltype(args)>(args)...);
+        })) {
+    }
+
+    // The callables refer to the metrics of the dispatcher.
+    InstrumentedDispatcher(const InstrumentedDispatcher&) = delete;
+    InstrumentedDispatcher& operator=(const InstrumentedDispatcher&) = delete;
+
+    /**
+     * \brief Dispatch a callable based on a key.
+     * \param key Value to dispatch with (KeyType, or a type the map can look up or convert to KeyType).
+     * \param args Arguments to pass to the callable.
+     * \return Result of callable.
+     * \warning Dispatching an unknown key without a default handler will throw an std::bad_function_call.
+     */
+    template <typename LookupKeyType, typename... ArgsType>
+    ResultType operator()(const LookupKeyType& key, ArgsType&&... args) {
+        return m_dispatcher(key, std::forward<ArgsType>(args)...);
+    }
+
+    /**
+     * \brief Take a snapshot of the activity of the dispatcher.
+     *
+     * Counters are relaxed atomics, a snapshot taken during calls may be slightly inconsistent.
+     * \return Activity of each key, and of the default handler.
+     */
+    Snapshot snapshot() const {
+        Snapshot snapshot;
+        for (size_t index = 0; index < m_keys.size(); index++) {
+            snapshot.keys.emplace(m_keys[index], m_metrics.stats(index));
+        }
+        snapshot.missing = m_metrics.stats(m_keys.size());
+        return snapshot;
+    }
+
+private:
+    // Record the call when leaving the scope, as an error if leaving by an exception.
+    class Timer {
+    public:
+        Timer(DispatchMetrics& metrics, size_t key)
+            : m_metrics(metrics), m_key(key), m_exceptions(std::uncaught_exceptions()), m_start(std::chrono::steady_clock::now()) { }
+
+        ~Timer() {
+            m_metrics.record(m_key, std::chrono::steady_clock::now() - m_start, std::uncaught_exceptions() > m_exceptions);
+        }
+
+    private:
+        DispatchMetrics& m_metrics;
+        size_t m_key;
+        int m_exceptions;
+        std::chrono::steady_clock::time_point m_start;
+    } ;
+
+    // Number the keys and wrap their callables in timers, the map is rebuilt from the
+    // wrapped entries since some maps (PerfectHashMap) are immutable.
+    Map instrument(const Map& map) {
+        std::vector<std::pair<KeyType, WorkFunctionType>> entries;
+        entries.reserve(map.size());
+        for (const auto& entry : map) {
+            entries.emplace_back(entry.first, WorkFunctionType([metrics = &m_metrics, index = m_keys.size(), work = entry.second](auto&&... args) -> ResultType {
+                Timer timer(*metrics, index);
+                return work(std::forward<decltype(args)>(args)...);
+            }));
+            m_keys.push_back(entry.first);
+        }
+        return Map(entries.begin(), entries.end());
+    }
+
+    DispatchMetrics m_metrics;
+    // Keys by index in m_metrics, the default handler comes last.
+    std::vector<KeyType> m_keys;
+    Dispatcher<KeyType, WorkFunctionType, MissingFunctionType, MapType> m_dispatcher;
+} ;
+
+}
+
+#endif
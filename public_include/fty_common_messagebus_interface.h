@@ -22,6 +22,7 @@
 #ifndef FTY_COMMON_MESSAGEBUS_INTERFACE_H_INCLUDED
 #define FTY_COMMON_MESSAGEBUS_INTERFACE_H_INCLUDED
 
+#include <cstdint>
 #include <functional>
 #include <string>
 
@@ -29,9 +30,33 @@ namespace messagebus {
 
 class Message;
 
-typedef void(MessageListenerFn)(Message);
+/**
+ * Listeners receive the decoded message by const reference: a message delivered
+ * to several listeners of the same topic or queue is decoded only once and shared
+ * between them. Listeners taking a Message by value are still accepted.
+ */
+typedef void(MessageListenerFn)(const Message&);
 using MessageListener = std::function<MessageListenerFn>;
 
+/// Opaque handle of one listener registered with subscribe() or receive().
+using SubscriptionHandle = uint64_t;
+
+/**
+ * Sends are asynchronous: the message is queued and written by the bus thread.
+ * The completion, if any, is called from the bus thread once the message has been
+ * handed over to the broker connection (true) or has failed to (false). It must
+ * not block.
+ */
+typedef void(SendCompletionFn)(bool);
+using SendCompletion = std::function<SendCompletionFn>;
+
+/// Delivery priority of a topic or a queue.
+enum class Priority
+{
+    Normal,
+    High
+};
+
 class MessageBus
 {
 public:
@@ -48,6 +73,8 @@ public:
     /**
      * @brief Publish message to a topic
      *
+     * A bus can publish to any number of topics.
+     *
      * @param topic     The topic to use
      * @param message   The message object to send
      *
@@ -55,19 +82,36 @@ public:
      */
     virtual void publish(const std::string& topic, const Message& message) = 0;
 
+    /**
+     * @brief Publish message to a topic, with completion notification
+     *
+     * @param topic       The topic to use
+     * @param message     The message object to send
+     * @param completion  Called once the message is written
+     *
+     * @throw MessageBusException any exceptions
+     */
+    virtual void publish(const std::string& topic, const Message& message, SendCompletion completion) = 0;
+
     /**
      * @brief Subscribe to a topic
      *
+     * Several listeners can subscribe to the same topic, each of them is called on message.
+     *
      * @param topic             The topic to subscribe
      * @param messageListener   The message listener to call on message
      *
+     * @return handle of the subscription, to use with unsubscribe(SubscriptionHandle)
+     *
      * @throw MessageBusException any exceptions
      */
-    virtual void subscribe(const std::string& topic, MessageListener messageListener) = 0;
+    virtual SubscriptionHandle subscribe(const std::string& topic, MessageListener messageListener) = 0;
 
     /**
      * @brief Unsubscribe to a topic
      *
+     * std::function can't be compared, so all the listeners of the topic are removed.
+     *
      * @param topic             The topic to unsubscribe
      * @param messageListener   The message listener to remove from topic
      *
@@ -75,6 +119,15 @@ public:
      */
     virtual void unsubscribe(const std::string& topic, MessageListener messageListener) = 0;
 
+    /**
+     * @brief Remove one listener registered with subscribe() or receive()
+     *
+     * @param handle            The handle returned on registration
+     *
+     * @throw MessageBusException any exceptions
+     */
+    virtual void unsubscribe(SubscriptionHandle handle) = 0;
+
     /**
      * @brief Send request to a queue
      *
@@ -85,6 +138,17 @@ public:
      */
     virtual void sendRequest(const std::string& requestQueue, const Message& message) = 0;
 
+    /**
+     * @brief Send request to a queue, with completion notification
+     *
+     * @param requestQueue    The queue to use
+     * @param message         The message to send
+     * @param completion      Called once the message is written
+     *
+     * @throw MessageBusException any exceptions
+     */
+    virtual void sendRequest(const std::string& requestQueue, const Message& message, SendCompletion completion) = 0;
+
     /**
      * @brief Send request to a queue and receive response to a specific listener
      *
@@ -107,15 +171,44 @@ public:
      */
     virtual void sendReply(const std::string& replyQueue, const Message& message) = 0;
 
+    /**
+     * @brief Send a reply to a queue, with completion notification
+     *
+     * @param replyQueue      The queue to use
+     * @param message         The message to send
+     * @param completion      Called once the message is written
+     *
+     * @throw MessageBusException any exceptions
+     */
+    virtual void sendReply(const std::string& replyQueue, const Message& message, SendCompletion completion) = 0;
+
     /**
      * @brief Receive message from queue
      *
+     * Several listeners can receive from the same queue, each of them is called on message.
+     *
      * @param queue             The queue where receive message
      * @param messageListener   The message listener to use for this queue
      *
+     * @return handle of the listener, to use with unsubscribe(SubscriptionHandle)
+     *
      * @throw MessageBusException any exceptions
      */
-    virtual void receive(const std::string& queue, MessageListener messageListener) = 0;
+    virtual SubscriptionHandle receive(const std::string& queue, MessageListener messageListener) = 0;
+
+    /**
+     * @brief Set the priority of a topic or a queue
+     *
+     * Messages of high priority topics and queues are written ahead of normal ones,
+     * and received ones are dispatched ahead of normal ones waiting to be.
+     * Normal messages still get their turn during a flood of high priority ones.
+     *
+     * @param name      The topic or queue
+     * @param priority  Its priority
+     *
+     * @throw MessageBusException any exceptions
+     */
+    virtual void setPriority(const std::string& name, Priority priority) = 0;
 
     /**
      * @brief Send request to a queue and wait to receive response
@@ -164,6 +257,41 @@ std::string getClientId(const std::string& prefix);
  * @return client Name
  */
 MessageBus* MlmMessageBus(const std::string& endpoint, const std::string& clientName);
+
+/**
+ * @brief In-process implementation
+ *
+ * Buses created with the same endpoint exchange messages within the process, with
+ * the addressing of the Malamute implementation (clientName is the mailbox address)
+ * and without serialization nor broker. Sending to a client which isn't connected
+ * completes with false, and request() to it fails right away.
+ *
+ * @param endpoint    Name of the in-process broker, created on first use
+ * @param clientName  Client name, unique per endpoint
+ *
+ * @return message bus
+ */
+MessageBus* InProcessMessageBus(const std::string& endpoint, const std::string& clientName);
+
+/**
+ * @brief Shared memory implementation
+ *
+ * Buses created with the same endpoint exchange messages between the processes of
+ * the host through rings in /dev/shm, with the addressing of the Malamute
+ * implementation and without broker. A mailbox only exists while its client is
+ * connected, messages sent to a client not connected are dropped. The mailboxes
+ * of crashed clients are removed by the next client connecting, unless they
+ * connect again first. A full mailbox blocks its writers for a while. Subscribers
+ * falling behind a topic by more than its ring skip ahead, losing the messages
+ * published meanwhile.
+ *
+ * @param endpoint    Name of the segments, shared by the processes talking together
+ * @param clientName  Client name, unique per endpoint
+ * @param ringSize    Size in bytes of the rings created by this client
+ *
+ * @return message bus
+ */
+MessageBus* SharedMemoryMessageBus(const std::string& endpoint, const std::string& clientName, size_t ringSize = 1 << 20);
 } // namespace messagebus
 
 #endif
@@ -45,6 +45,18 @@ typedef struct _fty_common_messagebus_dispatcher_t fty_common_messagebus_dispatc
 #define FTY_COMMON_MESSAGEBUS_DISPATCHER_T_DEFINED
 typedef struct _fty_common_messagebus_pool_worker_t fty_common_messagebus_pool_worker_t;
 #define FTY_COMMON_MESSAGEBUS_POOL_WORKER_T_DEFINED
+typedef struct _fty_common_messagebus_future_t fty_common_messagebus_future_t;
+#define FTY_COMMON_MESSAGEBUS_FUTURE_T_DEFINED
+typedef struct _fty_common_messagebus_strand_t fty_common_messagebus_strand_t;
+#define FTY_COMMON_MESSAGEBUS_STRAND_T_DEFINED
+typedef struct _fty_common_messagebus_rpc_server_t fty_common_messagebus_rpc_server_t;
+#define FTY_COMMON_MESSAGEBUS_RPC_SERVER_T_DEFINED
+typedef struct _fty_common_messagebus_async_dispatcher_t fty_common_messagebus_async_dispatcher_t;
+#define FTY_COMMON_MESSAGEBUS_ASYNC_DISPATCHER_T_DEFINED
+typedef struct _fty_common_messagebus_instrumented_dispatcher_t fty_common_messagebus_instrumented_dispatcher_t;
+#define FTY_COMMON_MESSAGEBUS_INSTRUMENTED_DISPATCHER_T_DEFINED
+typedef struct _fty_common_messagebus_serialization_t fty_common_messagebus_serialization_t;
+#define FTY_COMMON_MESSAGEBUS_SERIALIZATION_T_DEFINED
 
 
 //  Public classes, each with its own header file
@@ -54,6 +66,12 @@ typedef struct _fty_common_messagebus_pool_worker_t fty_common_messagebus_pool_w
 #include "fty_common_messagebus_interface.h"
 #include "fty_common_messagebus_dispatcher.h"
 #include "fty_common_messagebus_pool_worker.h"
+#include "fty_common_messagebus_future.h"
+#include "fty_common_messagebus_strand.h"
+#include "fty_common_messagebus_rpc_server.h"
+#include "fty_common_messagebus_async_dispatcher.h"
+#include "fty_common_messagebus_instrumented_dispatcher.h"
+#include "fty_common_messagebus_serialization.h"
 
 
 #ifdef __cplusplus
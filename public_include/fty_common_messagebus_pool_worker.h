@@ -22,28 +22,290 @@
 #ifndef FTY_COMMON_MESSAGEBUS_POOL_WORKER_H_INCLUDED
 #define FTY_COMMON_MESSAGEBUS_POOL_WORKER_H_INCLUDED
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <string>
 #include <thread>
+#include <tuple>
 #include <type_traits>
+#include <utility>
 #include <vector>
-#include <queue>
+
+#include "fty_common_messagebus_exception.h"
 
 namespace messagebus {
 
+class EventCount;
+class PoolWorkerJobQueue;
+class PoolWorkerStats;
+class PoolWorkerUrgentQueue;
+
+/**
+ * \brief Unit of work for pool worker.
+ *
+ * Move-only callable taking no argument. Callables small enough (which is the case
+ * of most lambdas and of the jobs packaged by PoolWorker) are stored inline, without
+ * allocation.
+ */
+class WorkUnit {
+public:
+    WorkUnit() noexcept = default;
+    WorkUnit(std::nullptr_t) noexcept { }
+
+    template <
+        typename Function,
+        typename = typename std::enable_if<!std::is_same<typename std::decay<Function>::type, WorkUnit>::value>::type
+    >
+    WorkUnit(Function&& fn) {
+        using Callable = typename std::decay<Function>::type;
+        construct<Callable>(std::forward<Function>(fn), std::integral_constant<bool, isInline<Callable>()>());
+    }
+
+    WorkUnit(WorkUnit&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    WorkUnit& operator=(WorkUnit&& other) noexcept {
+        if (this != &other) {
+            reset();
+            if (other.m_ops) {
+                other.m_ops->move(&m_storage, &other.m_storage);
+                m_ops       = other.m_ops;
+                other.m_ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    WorkUnit& operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
+
+    WorkUnit(const WorkUnit&) = delete;
+    WorkUnit& operator=(const WorkUnit&) = delete;
+
+    ~WorkUnit() {
+        reset();
+    }
+
+    /**
+     * \brief Do the work.
+     * \warning Calling an empty WorkUnit will throw an std::bad_function_call.
+     */
+    void operator()() {
+        if (!m_ops) {
+            throw std::bad_function_call();
+        }
+        m_ops->invoke(&m_storage);
+    }
+
+    explicit operator bool() const noexcept {
+        return m_ops != nullptr;
+    }
+
+private:
+    /// \brief Inline storage, sized so that a WorkUnit fills one cache line.
+    static constexpr size_t INLINE_SIZE = 64 - sizeof(void*);
+
+    struct Ops {
+        void (*invoke)(void*);
+        void (*move)(void*, void*) noexcept;
+        void (*destroy)(void*) noexcept;
+    } ;
+
+    template <typename Callable>
+    static constexpr bool isInline() {
+        return sizeof(Callable) <= INLINE_SIZE && alignof(Callable) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<Callable>::value;
+    }
+
+    template <typename Callable>
+    struct InlineModel {
+        static void invoke(void* storage) {
+            (*static_cast<Callable*>(storage))();
+        }
+        static void move(void* to, void* from) noexcept {
+            new (to) Callable(std::move(*static_cast<Callable*>(from)));
+            static_cast<Callable*>(from)->~Callable();
+        }
+        static void destroy(void* storage) noexcept {
+            static_cast<Callable*>(storage)->~Callable();
+        }
+        static const Ops ops;
+    } ;
+
+    template <typename Callable>
+    struct HeapModel {
+        static void invoke(void* storage) {
+            (**static_cast<Callable**>(storage))();
+        }
+        static void move(void* to, void* from) noexcept {
+            *static_cast<Callable**>(to) = *static_cast<Callable**>(from);
+        }
+        static void destroy(void* storage) noexcept {
+            delete *static_cast<Callable**>(storage);
+        }
+        static const Ops ops;
+    } ;
+
+    template <typename Callable, typename Function>
+    void construct(Function&& fn, std::true_type /*inline*/) {
+        new (&m_storage) Callable(std::forward<Function>(fn));
+        m_ops = &InlineModel<Callable>::ops;
+    }
+
+    template <typename Callable, typename Function>
+    void construct(Function&& fn, std::false_type /*inline*/) {
+        *reinterpret_cast<Callable**>(&m_storage) = new Callable(std::forward<Function>(fn));
+        m_ops = &HeapModel<Callable>::ops;
+    }
+
+    void reset() noexcept {
+        if (m_ops) {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type m_storage;
+    const Ops* m_ops = nullptr;
+} ;
+
+template <typename Callable>
+const WorkUnit::Ops WorkUnit::InlineModel<Callable>::ops = {&invoke, &move, &destroy};
+
+template <typename Callable>
+const WorkUnit::Ops WorkUnit::HeapModel<Callable>::ops = {&invoke, &move, &destroy};
+
 /**
  * \brief Pool of worker threads.
  */
 class PoolWorker {
 public:
+    /// \brief How work is queued and handed over to the workers.
+    enum class Scheduler {
+        /// One queue shared by all the workers.
+        SharedQueue,
+        /// One queue per worker, idle workers steal work from randomly picked other workers.
+        WorkStealing,
+        /// One bounded lock-free ring shared by all the workers (work beyond its capacity is queued under a lock).
+        LockFreeRing,
+    } ;
+
+    /// \brief Options of a pool of worker threads.
+    struct Options {
+        /// Number of workers (work will be processed synchronously if 0 and maxWorkers is 0).
+        size_t workers = 0;
+        /// Maximum number of workers, the pool grows up to it under load and shrinks back to workers when idle.
+        size_t maxWorkers = 0;
+        /// How long work may have been waiting for a worker before the pool grows by one worker.
+        std::chrono::milliseconds growthLatency = std::chrono::milliseconds(5);
+        /// How long a worker above the minimum number of workers stays idle before exiting.
+        std::chrono::milliseconds idleTimeout = std::chrono::seconds(30);
+        /// Waiting time worth one priority level, so that low priority work isn't starved.
+        std::chrono::milliseconds priorityAging = std::chrono::milliseconds(10);
+        /// How work is handed over to the workers.
+        Scheduler scheduler = Scheduler::SharedQueue;
+        /// Capacity of the ring of Scheduler::LockFreeRing, rounded up to a power of two.
+        size_t ringCapacity = 1024;
+        /// Name of the worker threads, suffixed with their index (truncated to fit in 15 characters).
+        std::string name;
+        /// CPUs the workers are pinned to (no pinning if empty).
+        std::vector<int> cpus;
+        /// NUMA node whose CPUs are added to the CPUs the workers are pinned to (none if negative).
+        int numaNode = -1;
+        /// Nice value of the workers (inherited if 0).
+        int niceness = 0;
+        /// SCHED_FIFO real-time priority of the workers (normal scheduling if 0).
+        int realtimePriority = 0;
+    } ;
+
+    /**
+     * \brief Priority and deadline of work.
+     *
+     * Work is done in order of virtual deadline: the earliest of its deadline and the time it
+     * was queued minus its priority times Options::priorityAging. Work scheduled without
+     * urgency is done in order, interleaved with urgent work so that it isn't starved either.
+     */
+    struct Urgency {
+        using Clock = std::chrono::steady_clock;
+
+        Urgency(int prio = 0) : priority(prio) { }
+        Urgency(Clock::time_point dl, bool discard = false) : deadline(dl), discardExpired(discard) { }
+        Urgency(int prio, Clock::time_point dl, bool discard = false) : priority(prio), deadline(dl), discardExpired(discard) { }
+
+        /// Higher is more urgent.
+        int priority = 0;
+        Clock::time_point deadline = Clock::time_point::max();
+        /// Whether to skip the work if its deadline passed before it started (its future then holds an ExpiredException).
+        bool discardExpired = false;
+    } ;
+
+    /// \brief Work skipped because its deadline passed.
+    class ExpiredException : public MessageBusException {
+    public:
+        ExpiredException() : MessageBusException("Deadline of work expired") { }
+    } ;
+
+    /// \brief Distribution of durations.
+    struct Histogram {
+        static constexpr size_t BUCKETS = 24;
+
+        /// Bucket 0 counts durations under 1 µs, bucket i durations in [2^(i-1), 2^i) µs and the last one all the longer ones.
+        std::array<uint64_t, BUCKETS> buckets {};
+        uint64_t count = 0;
+        std::chrono::nanoseconds total {0};
+        std::chrono::nanoseconds max {0};
+
+        /**
+         * \brief Estimate a percentile of the durations.
+         * \param percent Percentile to estimate, between 0 and 100.
+         * \return Upper bound of the bucket containing the percentile (max for the last bucket).
+         */
+        std::chrono::nanoseconds percentile(double percent) const;
+    } ;
+
+    /// \brief Snapshot of the activity of a pool, since its creation.
+    struct Stats {
+        /// Whether statistics are collected (false if compiled out, then only workers and idleWorkers are set).
+        bool enabled = false;
+        size_t workers = 0;
+        size_t idleWorkers = 0;
+        uint64_t scheduled = 0;
+        uint64_t completed = 0;
+        size_t queueDepth = 0;
+        size_t maxQueueDepth = 0;
+        /// Time spent in queue before running.
+        Histogram waitTime;
+        /// Time spent running.
+        Histogram runTime;
+    } ;
+
     /**
      * \brief Create a pool of worker threads.
      * \param workers Number of workers (work will be processed synchronously if 0).
+     * \param scheduler How work is handed over to the workers.
+     */
+    PoolWorker(size_t workers, Scheduler scheduler = Scheduler::SharedQueue);
+
+    /**
+     * \brief Create a pool of worker threads.
+     *
+     * Failing to apply the name, CPU affinity or priority of a worker is logged, not fatal.
+     * \param options Options of the pool.
+     * \throw std::runtime_error if the CPUs of the NUMA node can't be found.
      */
-    PoolWorker(size_t workers);
+    explicit PoolWorker(const Options& options);
 
     // PoolWorker can't be copied, assigned or moved.
     PoolWorker() = delete;
@@ -60,6 +322,24 @@ public:
      */
     ~PoolWorker();
 
+    /**
+     * \brief Number of running workers.
+     *
+     * Only changes over time if the pool is elastic (Options::maxWorkers above Options::workers).
+     * \return Number of running workers.
+     */
+    size_t workerCount() const;
+
+    /**
+     * \brief Take a snapshot of the statistics of the pool.
+     *
+     * Statistics are collected with relaxed atomics, a snapshot taken while work is running
+     * may be slightly inconsistent. They are compiled out if FTY_COMMON_MESSAGEBUS_NO_POOL_WORKER_STATS
+     * is defined when building the library.
+     * \return Statistics of the pool.
+     */
+    Stats stats() const;
+
     /**
      * \brief Schedule work (keep a std::future for the result).
      * \param work Callable of the work to do.
@@ -72,13 +352,38 @@ public:
         typename ReturnType = decltype(std::declval<Function&&>()(std::declval<Args&&>()...))
     >
     auto schedule(Function&& fn, Args&&... args) -> std::future<ReturnType> {
-        using PackagedTask = std::packaged_task<ReturnType()>;
+        // Package the work into a storable form, only the shared state of the promise is allocated.
+        PromisedCall<ReturnType, BoundCall<Function, Args...>> packagedTask {
+            BoundCall<Function, Args...>{std::forward<Function>(fn), std::make_tuple(std::forward<Args>(args)...)},
+            std::promise<ReturnType>()
+        };
+        auto future = packagedTask.promise.get_future();
 
-        // Package the work into a storable form.
-        auto packagedTask = std::make_shared<PackagedTask>(std::bind(std::forward<Function&&>(fn), std::forward<Args&&>(args)...));
+        this->scheduleWork(WorkUnit(std::move(packagedTask)));
+        return future;
+    }
 
-        this->scheduleWork(std::move([packagedTask]() { (*packagedTask)(); }));
-        return packagedTask->get_future();
+    /**
+     * \brief Schedule urgent work (keep a std::future for the result).
+     * \param urgency Priority and deadline of the work.
+     * \param work Callable of the work to do.
+     * \param args Arguments to pass to the callable.
+     * \return A future of the return value of the callable.
+     */
+    template<
+        typename Function,
+        typename... Args,
+        typename ReturnType = decltype(std::declval<Function&&>()(std::declval<Args&&>()...))
+    >
+    auto schedule(const Urgency& urgency, Function&& fn, Args&&... args) -> std::future<ReturnType> {
+        PromisedCall<ReturnType, BoundCall<Function, Args...>> packagedTask {
+            BoundCall<Function, Args...>{std::forward<Function>(fn), std::make_tuple(std::forward<Args>(args)...)},
+            std::promise<ReturnType>()
+        };
+        auto future = packagedTask.promise.get_future();
+
+        this->scheduleUrgentWork(urgency, packageUrgentWork(urgency, std::move(packagedTask)));
+        return future;
     }
 
     /**
@@ -88,26 +393,236 @@ public:
      */
     template<
         typename Function,
-        typename... Args
+        typename... Args,
+        typename = decltype(std::declval<Function&&>()(std::declval<Args&&>()...))
     >
     auto offload(Function&& fn, Args&&... args) -> void {
         // Package the work into a storable form.
-        WorkUnit packagedTask = std::bind(std::forward<Function&&>(fn), std::forward<Args&&>(args)...);
+        WorkUnit packagedTask = BoundCall<Function, Args...>{std::forward<Function>(fn), std::make_tuple(std::forward<Args>(args)...)};
 
         this->scheduleWork(std::move(packagedTask));
     }
 
+    /**
+     * \brief Offload urgent work (do not keep a std::future for the result).
+     * \param urgency Priority and deadline of the work.
+     * \param work Callable of the work to do.
+     * \param args Arguments to pass to the callable.
+     */
+    template<
+        typename Function,
+        typename... Args,
+        typename = decltype(std::declval<Function&&>()(std::declval<Args&&>()...))
+    >
+    auto offload(const Urgency& urgency, Function&& fn, Args&&... args) -> void {
+        BoundCall<Function, Args...> call {std::forward<Function>(fn), std::make_tuple(std::forward<Args>(args)...)};
+
+        this->scheduleUrgentWork(urgency, packageUrgentWork(urgency, std::move(call)));
+    }
+
+    /**
+     * \brief Offload a batch of work at once (do not keep std::future for the results).
+     *
+     * The whole batch is queued with one lock acquisition and wakes up the workers once.
+     * \param works Work to do.
+     */
+    void offloadBatch(std::vector<WorkUnit>&& works);
+
+    /**
+     * \brief Call a function for each index of a range, in parallel, and wait for completion.
+     *
+     * The range is split into chunks run by the workers and by the calling thread, which
+     * makes it safe to call from a worker. If calls throw, the first exception is rethrown
+     * once all the chunks are done.
+     * \param begin First index of the range.
+     * \param end Past the last index of the range.
+     * \param grainSize Number of indexes per chunk (0 to let the pool decide).
+     * \param fn Callable called with each index.
+     */
+    template <typename Function>
+    void parallelFor(size_t begin, size_t end, size_t grainSize, Function&& fn) {
+        if (begin >= end) {
+            return;
+        }
+
+        const size_t count  = end - begin;
+        const size_t chunks = chunkCount(count, grainSize);
+        runChunks(chunks, [&](size_t chunk) {
+            for (size_t i = begin + chunkBegin(count, chunks, chunk); i < begin + chunkBegin(count, chunks, chunk + 1); i++) {
+                fn(i);
+            }
+        });
+    }
+
+    /**
+     * \brief Reduce a range in parallel and wait for the result.
+     *
+     * Each chunk of the range is reduced starting from identity, then the results of the
+     * chunks are combined in order.
+     * \param begin First index of the range.
+     * \param end Past the last index of the range.
+     * \param grainSize Number of indexes per chunk (0 to let the pool decide).
+     * \param identity Initial value of the reduction of each chunk.
+     * \param fn Callable returning the reduction of an accumulated value and an index.
+     * \param combine Callable returning the combination of two reduced values.
+     * \return The reduction of the range.
+     */
+    template <typename Value, typename Function, typename Combine>
+    Value parallelReduce(size_t begin, size_t end, size_t grainSize, Value identity, Function&& fn, Combine&& combine) {
+        if (begin >= end) {
+            return identity;
+        }
+
+        // One slot per chunk, each on its own cache line: chunks are written concurrently,
+        // which a std::vector<bool> (packed bits) or adjacent values can't take.
+        struct alignas(64) Slot {
+            Value value;
+        } ;
+
+        const size_t      count  = end - begin;
+        const size_t      chunks = chunkCount(count, grainSize);
+        std::vector<Slot> results(chunks, Slot{identity});
+        runChunks(chunks, [&](size_t chunk) {
+            Value accumulator = identity;
+            for (size_t i = begin + chunkBegin(count, chunks, chunk); i < begin + chunkBegin(count, chunks, chunk + 1); i++) {
+                accumulator = fn(std::move(accumulator), i);
+            }
+            results[chunk].value = std::move(accumulator);
+        });
+
+        Value result = std::move(results[0].value);
+        for (size_t chunk = 1; chunk < chunks; chunk++) {
+            result = combine(std::move(result), std::move(results[chunk].value));
+        }
+        return result;
+    }
+
 private:
-    /// \brief Unit of work for pool worker.
-    using WorkUnit = std::function<void()>;
+    friend class Strand;
+
+    /**
+     * \brief Callable and copies of its arguments, called once.
+     *
+     * The copies are moved into the call when the callable accepts it (move-only
+     * arguments), and passed as lvalues otherwise like std::bind does (callables
+     * taking non-const references).
+     */
+    template <typename Function, typename... Args>
+    struct BoundCall {
+        typename std::decay<Function>::type fn;
+        std::tuple<typename std::decay<Args>::type...> args;
+
+        template <size_t... Indexes>
+        auto call(std::index_sequence<Indexes...>, int) -> decltype(fn(std::move(std::get<Indexes>(args))...)) {
+            return fn(std::move(std::get<Indexes>(args))...);
+        }
+
+        template <size_t... Indexes>
+        auto call(std::index_sequence<Indexes...>, long) -> decltype(fn(std::get<Indexes>(args)...)) {
+            return fn(std::get<Indexes>(args)...);
+        }
+
+        auto operator()() -> decltype(call(std::index_sequence_for<Args...>(), 0)) {
+            return call(std::index_sequence_for<Args...>(), 0);
+        }
+    } ;
+
+    /// \brief Call fulfilling a promise with its result.
+    template <typename ReturnType, typename Call>
+    struct PromisedCall {
+        Call call;
+        std::promise<ReturnType> promise;
+
+        void operator()() {
+            try {
+                fulfill(promise, call);
+            }
+            catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        }
+    } ;
+
+    template <typename ReturnType, typename Call>
+    static void fulfill(std::promise<ReturnType>& promise, Call& call) {
+        promise.set_value(call());
+    }
+
+    template <typename Call>
+    static void fulfill(std::promise<void>& promise, Call& call) {
+        call();
+        promise.set_value();
+    }
+
+    /// \brief Call skipped once its deadline passed.
+    template <typename Call>
+    struct ExpiringCall {
+        Call call;
+        Urgency::Clock::time_point deadline;
+
+        void operator()() {
+            if (Urgency::Clock::now() > deadline) {
+                expire(call);
+            }
+            else {
+                call();
+            }
+        }
+    } ;
+
+    template <typename Call>
+    static void expire(Call& /*call*/) {
+    }
+
+    template <typename ReturnType, typename Call>
+    static void expire(PromisedCall<ReturnType, Call>& call) {
+        call.promise.set_exception(std::make_exception_ptr(ExpiredException()));
+    }
+
+    template <typename Call>
+    static WorkUnit packageUrgentWork(const Urgency& urgency, Call&& call) {
+        if (urgency.discardExpired && urgency.deadline != Urgency::Clock::time_point::max()) {
+            return WorkUnit(ExpiringCall<typename std::decay<Call>::type>{std::forward<Call>(call), urgency.deadline});
+        }
+        return WorkUnit(std::forward<Call>(call));
+    }
+
     void scheduleWork(WorkUnit&& work);
+    void scheduleUrgentWork(const Urgency& urgency, WorkUnit&& work);
+    size_t chunkCount(size_t count, size_t grainSize) const;
+
+    /// \brief Offset of a chunk in a range, without overflowing on large ranges.
+    static size_t chunkBegin(size_t count, size_t chunks, size_t chunk) {
+        return count / chunks * chunk + std::min(chunk, count % chunks);
+    }
+    void runChunks(size_t chunks, std::function<void(size_t)> runChunk);
+    void notifyWorkers(bool all);
+    void growWorkers();
+    void superviseWorkers();
+    void spawnWorker();
+    void workerMainloop(size_t index);
+    void configureWorker(size_t index);
 
+    Options m_options;
     std::atomic_bool m_terminated;
+    // One slot per possible worker, m_running tells which ones are in use (guarded by m_mutex).
     std::vector<std::thread> m_workers;
+    std::vector<bool> m_running;
+    std::atomic<size_t> m_live;
+    std::unique_ptr<PoolWorkerJobQueue> m_jobs;
+    std::unique_ptr<PoolWorkerUrgentQueue> m_urgent;
+    std::unique_ptr<PoolWorkerStats> m_stats;
 
+    // Guards the worker slots.
     std::mutex m_mutex;
-    std::queue<WorkUnit> m_jobs;
-    std::condition_variable m_cv;
+    // Idle workers sleep on m_idle, pushing work only wakes one up if some are sleeping.
+    std::unique_ptr<EventCount> m_idle;
+
+    // Since when (steady clock, in ns) work is queued while no worker is idle, 0 if not.
+    std::atomic<int64_t> m_backlogSince;
+    // Elastic pools only: grows the pool while every worker is stuck in a long job (waits on m_mutex).
+    std::thread m_supervisor;
+    std::condition_variable m_supervise;
 } ;
 
 }
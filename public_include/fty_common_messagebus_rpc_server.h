@@ -0,0 +1,93 @@
+/*  =========================================================================
+    fty_common_messagebus_rpc_server - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_COMMON_MESSAGEBUS_RPC_SERVER_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_RPC_SERVER_H_INCLUDED
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "fty_common_messagebus_dispatcher.h"
+#include "fty_common_messagebus_interface.h"
+#include "fty_common_messagebus_message.h"
+#include "fty_common_messagebus_pool_worker.h"
+
+namespace messagebus {
+
+class RpcServerState;
+
+/**
+ * \brief Request/reply server, dispatching the requests received on a queue by subject.
+ *
+ * The handler of the subject of a request returns the user data of the reply, or
+ * throws. The reply is sent to the _replyTo queue of the request, addressed to its
+ * sender (_from) with the same subject and _correlationId, and _status=ok. If the
+ * handler throws, _status=ko and the user data is the error message. Requests
+ * without _replyTo or _from are handled without reply.
+ */
+class RpcServer {
+public:
+    /// \brief Handler of a subject, returns the user data of the reply.
+    using Handler = std::function<UserData(const Message&)>;
+    /// \brief Handler of unknown subjects.
+    using DefaultHandler = std::function<UserData(const std::string&, const Message&)>;
+    /// \brief Handlers by subject.
+    using Handlers = Dispatcher<std::string, Handler, DefaultHandler>;
+
+    /**
+     * \brief Start receiving requests.
+     * \param bus Message bus, must outlive the requests being handled.
+     * \param queue Queue to receive the requests on.
+     * \param handlers Handlers by subject, called concurrently if pool has several workers.
+     * \param pool Pool running the handlers, or nullptr to run them in the thread of the bus.
+     * \throw MessageBusException if the queue can't be received.
+     */
+    RpcServer(MessageBus& bus, const std::string& queue, Handlers handlers, PoolWorker* pool = nullptr);
+
+    /**
+     * \brief Stop receiving requests.
+     *
+     * Requests already scheduled on the pool are still handled and replied to.
+     */
+    ~RpcServer();
+
+    // RpcServer can't be copied, assigned or moved.
+    RpcServer(const RpcServer&) = delete;
+    RpcServer(RpcServer&&) = delete;
+    RpcServer& operator=(const RpcServer&) = delete;
+    RpcServer& operator=(RpcServer&&) = delete;
+
+    /**
+     * \brief Handle a request and send its reply, in the calling thread.
+     * \param request Request to handle.
+     */
+    void handle(const Message& request);
+
+private:
+    std::shared_ptr<RpcServerState> m_state;
+    MessageBus& m_bus;
+    SubscriptionHandle m_handle;
+} ;
+
+}
+
+#endif
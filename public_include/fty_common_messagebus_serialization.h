@@ -0,0 +1,419 @@
+/*  =========================================================================
+    fty_common_messagebus_serialization - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_COMMON_MESSAGEBUS_SERIALIZATION_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_SERIALIZATION_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <list>
+#include <map>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fty_common_messagebus_exception.h"
+
+namespace messagebus {
+
+/**
+ * \brief Appends the binary encoding of values to a frame.
+ *
+ * Integers are varints (zigzag for signed ones), floating point numbers are fixed
+ * width little endian, strings and containers are prefixed by their size.
+ */
+class BinaryWriter {
+public:
+    explicit BinaryWriter(std::string& frame) : m_frame(frame) { }
+
+    void varint(uint64_t value) {
+        char buffer[10];
+        size_t size = 0;
+        while (value >= 0x80) {
+            buffer[size++] = char(value | 0x80);
+            value >>= 7;
+        }
+        buffer[size++] = char(value);
+        m_frame.append(buffer, size);
+    }
+
+    template <typename IntegerType>
+    void fixed(IntegerType value) {
+        static_assert(std::is_unsigned<IntegerType>::value, "fixed width values are unsigned");
+        char buffer[sizeof(IntegerType)];
+        for (size_t i = 0; i < sizeof(IntegerType); i++) {
+            buffer[i] = char(value >> (8 * i));
+        }
+        m_frame.append(buffer, sizeof(IntegerType));
+    }
+
+    void bytes(const char *data, size_t size) {
+        m_frame.append(data, size);
+    }
+
+    static size_t varintSize(uint64_t value) {
+        size_t size = 1;
+        while (value >= 0x80) {
+            value >>= 7;
+            size++;
+        }
+        return size;
+    }
+
+private:
+    std::string& m_frame;
+} ;
+
+/**
+ * \brief Reads values from a binary frame written by BinaryWriter.
+ *
+ * Reads are bounds checked, a truncated or malformed frame throws MessageBusException.
+ */
+class BinaryReader {
+public:
+    explicit BinaryReader(std::string_view frame) : m_frame(frame) { }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = uint8_t(bytes(1)[0]);
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw MessageBusException("Malformed varint in binary frame.");
+    }
+
+    template <typename IntegerType>
+    IntegerType fixed() {
+        static_assert(std::is_unsigned<IntegerType>::value, "fixed width values are unsigned");
+        const char *data = bytes(sizeof(IntegerType)).data();
+        IntegerType value = 0;
+        for (size_t i = 0; i < sizeof(IntegerType); i++) {
+            value |= IntegerType(uint8_t(data[i])) << (8 * i);
+        }
+        return value;
+    }
+
+    std::string_view bytes(size_t size) {
+        if (size > m_frame.size()) {
+            throw MessageBusException("Truncated binary frame.");
+        }
+        std::string_view data = m_frame.substr(0, size);
+        m_frame.remove_prefix(size);
+        return data;
+    }
+
+    bool atEnd() const {
+        return m_frame.empty();
+    }
+
+private:
+    std::string_view m_frame;
+} ;
+
+/**
+ * \brief Binary encoding of a type: size(value), write(writer, value) and read(reader, value).
+ *
+ * Defined for integers, enums, floating point numbers, strings, vectors, lists, maps
+ * and structs declaring their fields. Specialize it for other types.
+ */
+template <typename ValueType, typename = void>
+struct BinaryCodec;
+
+/// \brief Fields of a struct, a tuple of pointers to its members returned by a static fields().
+template <typename ValueType>
+using BinaryFields = decltype(ValueType::fields());
+
+template <typename ValueType>
+struct BinaryCodec<ValueType, std::enable_if_t<std::is_unsigned<ValueType>::value>> {
+    static size_t size(ValueType value) {
+        return BinaryWriter::varintSize(value);
+    }
+
+    static void write(BinaryWriter& writer, ValueType value) {
+        writer.varint(value);
+    }
+
+    static void read(BinaryReader& reader, ValueType& value) {
+        uint64_t encoded = reader.varint();
+        if (encoded > std::numeric_limits<ValueType>::max()) {
+            throw MessageBusException("Value out of range in binary frame.");
+        }
+        value = ValueType(encoded);
+    }
+} ;
+
+// Signed integers are zigzag encoded, so that small negative values stay short.
+template <typename ValueType>
+struct BinaryCodec<ValueType, std::enable_if_t<std::is_integral<ValueType>::value && std::is_signed<ValueType>::value>> {
+    static uint64_t zigzag(ValueType value) {
+        return (uint64_t(value) << 1) ^ uint64_t(int64_t(value) >> 63);
+    }
+
+    static size_t size(ValueType value) {
+        return BinaryWriter::varintSize(zigzag(value));
+    }
+
+    static void write(BinaryWriter& writer, ValueType value) {
+        writer.varint(zigzag(value));
+    }
+
+    static void read(BinaryReader& reader, ValueType& value) {
+        uint64_t encoded = reader.varint();
+        int64_t decoded = int64_t(encoded >> 1) ^ -int64_t(encoded & 1);
+        if (decoded < std::numeric_limits<ValueType>::min() || decoded > std::numeric_limits<ValueType>::max()) {
+            throw MessageBusException("Value out of range in binary frame.");
+        }
+        value = ValueType(decoded);
+    }
+} ;
+
+template <typename ValueType>
+struct BinaryCodec<ValueType, std::enable_if_t<std::is_enum<ValueType>::value>> {
+    using Underlying = BinaryCodec<std::underlying_type_t<ValueType>>;
+
+    static size_t size(ValueType value) {
+        return Underlying::size(std::underlying_type_t<ValueType>(value));
+    }
+
+    static void write(BinaryWriter& writer, ValueType value) {
+        Underlying::write(writer, std::underlying_type_t<ValueType>(value));
+    }
+
+    static void read(BinaryReader& reader, ValueType& value) {
+        std::underlying_type_t<ValueType> decoded;
+        Underlying::read(reader, decoded);
+        value = ValueType(decoded);
+    }
+} ;
+
+template <typename ValueType>
+struct BinaryCodec<ValueType, std::enable_if_t<std::is_floating_point<ValueType>::value>> {
+    static_assert(sizeof(ValueType) == 4 || sizeof(ValueType) == 8, "float and double only");
+    using Bits = std::conditional_t<sizeof(ValueType) == 4, uint32_t, uint64_t>;
+
+    static size_t size(ValueType) {
+        return sizeof(ValueType);
+    }
+
+    static void write(BinaryWriter& writer, ValueType value) {
+        Bits bits;
+        memcpy(&bits, &value, sizeof(bits));
+        writer.fixed(bits);
+    }
+
+    static void read(BinaryReader& reader, ValueType& value) {
+        Bits bits = reader.fixed<Bits>();
+        memcpy(&value, &bits, sizeof(bits));
+    }
+} ;
+
+template <>
+struct BinaryCodec<std::string> {
+    static size_t size(const std::string& value) {
+        return BinaryWriter::varintSize(value.size()) + value.size();
+    }
+
+    static void write(BinaryWriter& writer, const std::string& value) {
+        writer.varint(value.size());
+        writer.bytes(value.data(), value.size());
+    }
+
+    static void read(BinaryReader& reader, std::string& value) {
+        std::string_view data = reader.bytes(reader.varint());
+        value.assign(data.data(), data.size());
+    }
+} ;
+
+/// \brief Binary encoding of a sequence container, its number of items then the items.
+template <typename ContainerType>
+struct BinarySequenceCodec {
+    using Item = typename ContainerType::value_type;
+
+    static size_t size(const ContainerType& values) {
+        size_t size = BinaryWriter::varintSize(values.size());
+        for (const auto& value : values) {
+            size += BinaryCodec<Item>::size(value);
+        }
+        return size;
+    }
+
+    static void write(BinaryWriter& writer, const ContainerType& values) {
+        writer.varint(values.size());
+        for (const auto& value : values) {
+            BinaryCodec<Item>::write(writer, value);
+        }
+    }
+
+    static void read(BinaryReader& reader, ContainerType& values) {
+        uint64_t count = reader.varint();
+        values.clear();
+        for (uint64_t i = 0; i < count; i++) {
+            // Each item takes a byte at least, check before growing.
+            if (reader.atEnd()) {
+                throw MessageBusException("Truncated binary frame.");
+            }
+            values.emplace_back();
+            BinaryCodec<Item>::read(reader, values.back());
+        }
+    }
+} ;
+
+template <typename ItemType>
+struct BinaryCodec<std::vector<ItemType>> : BinarySequenceCodec<std::vector<ItemType>> { } ;
+
+template <typename ItemType>
+struct BinaryCodec<std::list<ItemType>> : BinarySequenceCodec<std::list<ItemType>> { } ;
+
+template <typename KeyType, typename ValueType, typename Compare>
+struct BinaryCodec<std::map<KeyType, ValueType, Compare>> {
+    using Map = std::map<KeyType, ValueType, Compare>;
+
+    static size_t size(const Map& values) {
+        size_t size = BinaryWriter::varintSize(values.size());
+        for (const auto& pair : values) {
+            size += BinaryCodec<KeyType>::size(pair.first) + BinaryCodec<ValueType>::size(pair.second);
+        }
+        return size;
+    }
+
+    static void write(BinaryWriter& writer, const Map& values) {
+        writer.varint(values.size());
+        for (const auto& pair : values) {
+            BinaryCodec<KeyType>::write(writer, pair.first);
+            BinaryCodec<ValueType>::write(writer, pair.second);
+        }
+    }
+
+    static void read(BinaryReader& reader, Map& values) {
+        uint64_t count = reader.varint();
+        values.clear();
+        for (uint64_t i = 0; i < count; i++) {
+            KeyType key;
+            BinaryCodec<KeyType>::read(reader, key);
+            BinaryCodec<ValueType>::read(reader, values[std::move(key)]);
+        }
+    }
+} ;
+
+/**
+ * \brief Binary encoding of a struct declaring its fields.
+ *
+ * Fields are encoded in order, without names nor tags. When decoding, fields missing
+ * at the end of the frame keep their value and unknown trailing bytes are skipped, so
+ * fields can be appended to a struct without breaking its older readers and writers.
+ * Nested structs are prefixed by their size for that purpose.
+ */
+template <typename ValueType>
+struct BinaryCodec<ValueType, std::void_t<BinaryFields<ValueType>>> {
+    static size_t fieldsSize(const ValueType& value) {
+        return std::apply([&value](auto... fields) {
+            return (size_t(0) + ... + codec(fields).size(value.*fields));
+        }, ValueType::fields());
+    }
+
+    static void writeFields(BinaryWriter& writer, const ValueType& value) {
+        std::apply([&writer, &value](auto... fields) {
+            (codec(fields).write(writer, value.*fields), ...);
+        }, ValueType::fields());
+    }
+
+    static void readFields(BinaryReader& reader, ValueType& value) {
+        std::apply([&reader, &value](auto... fields) {
+            ((reader.atEnd() ? void() : codec(fields).read(reader, value.*fields)), ...);
+        }, ValueType::fields());
+    }
+
+    static size_t size(const ValueType& value) {
+        size_t size = fieldsSize(value);
+        return BinaryWriter::varintSize(size) + size;
+    }
+
+    static void write(BinaryWriter& writer, const ValueType& value) {
+        writer.varint(fieldsSize(value));
+        writeFields(writer, value);
+    }
+
+    static void read(BinaryReader& reader, ValueType& value) {
+        BinaryReader fields(reader.bytes(reader.varint()));
+        readFields(fields, value);
+    }
+
+private:
+    template <typename FieldType>
+    static BinaryCodec<std::remove_cv_t<FieldType>> codec(FieldType ValueType::*) {
+        return {};
+    }
+} ;
+
+/**
+ * \brief Encode a struct declaring its fields into a frame.
+ * \param value Struct to encode.
+ * \param frame Frame to append the encoding to.
+ */
+template <typename ValueType, typename Codec = BinaryCodec<ValueType>>
+void encode(const ValueType& value, std::string& frame) {
+    frame.reserve(frame.size() + Codec::fieldsSize(value));
+    BinaryWriter writer(frame);
+    Codec::writeFields(writer, value);
+}
+
+/**
+ * \brief Encode a struct declaring its fields.
+ * \param value Struct to encode.
+ * \return Binary frame, for instance a frame of UserData.
+ */
+template <typename ValueType, typename Codec = BinaryCodec<ValueType>>
+std::string encode(const ValueType& value) {
+    std::string frame;
+    encode(value, frame);
+    return frame;
+}
+
+/**
+ * \brief Decode a struct declaring its fields.
+ * \param frame Binary frame written by encode().
+ * \param value Struct to decode into, fields missing from the frame are kept.
+ * \throw MessageBusException if the frame is truncated or malformed.
+ */
+template <typename ValueType, typename Codec = BinaryCodec<ValueType>>
+void decode(std::string_view frame, ValueType& value) {
+    BinaryReader reader(frame);
+    Codec::readFields(reader, value);
+}
+
+/// \brief Decode a struct declaring its fields, see decode(frame, value).
+template <typename ValueType, typename Codec = BinaryCodec<ValueType>>
+ValueType decode(std::string_view frame) {
+    ValueType value;
+    decode(frame, value);
+    return value;
+}
+
+}
+
+#endif
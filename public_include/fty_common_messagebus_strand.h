@@ -0,0 +1,121 @@
+/*  =========================================================================
+    fty_common_messagebus_strand - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_COMMON_MESSAGEBUS_STRAND_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_STRAND_H_INCLUDED
+
+#include <future>
+#include <memory>
+#include <tuple>
+#include <utility>
+
+#include "fty_common_messagebus_pool_worker.h"
+
+namespace messagebus {
+
+class StrandState;
+
+/**
+ * \brief Serial executor on a shared PoolWorker.
+ *
+ * Work posted to the same strand runs one at a time, in order, while different
+ * strands run in parallel on the workers of the pool. A strand only occupies a
+ * worker while it has work, and gives it back after a few jobs so that busy
+ * strands don't starve the others.
+ */
+class Strand {
+public:
+    /**
+     * \brief Create a strand.
+     * \param pool Pool doing the work, must outlive the work posted to the strand.
+     */
+    explicit Strand(PoolWorker& pool);
+
+    /**
+     * \brief Destroy the strand.
+     *
+     * Work already posted still runs, in order.
+     */
+    ~Strand();
+
+    // Strand can't be copied, assigned or moved.
+    Strand(const Strand&) = delete;
+    Strand(Strand&&) = delete;
+    Strand& operator=(const Strand&) = delete;
+    Strand& operator=(Strand&&) = delete;
+
+    /**
+     * \brief Schedule work (keep a std::future for the result).
+     * \param work Callable of the work to do.
+     * \param args Arguments to pass to the callable.
+     * \return A future of the return value of the callable.
+     */
+    template<
+        typename Function,
+        typename... Args,
+        typename ReturnType = decltype(std::declval<Function&&>()(std::declval<Args&&>()...))
+    >
+    auto schedule(Function&& fn, Args&&... args) -> std::future<ReturnType> {
+        using Call = PoolWorker::BoundCall<Function, Args...>;
+
+        PoolWorker::PromisedCall<ReturnType, Call> packagedTask {
+            Call{std::forward<Function>(fn), std::make_tuple(std::forward<Args>(args)...)},
+            std::promise<ReturnType>()
+        };
+        auto future = packagedTask.promise.get_future();
+
+        post(WorkUnit(std::move(packagedTask)));
+        return future;
+    }
+
+    /**
+     * \brief Offload work (do not keep a std::future for the result).
+     * \param work Callable of the work to do.
+     * \param args Arguments to pass to the callable.
+     */
+    template<
+        typename Function,
+        typename... Args,
+        typename = decltype(std::declval<Function&&>()(std::declval<Args&&>()...))
+    >
+    auto offload(Function&& fn, Args&&... args) -> void {
+        post(WorkUnit(PoolWorker::BoundCall<Function, Args...>{std::forward<Function>(fn), std::make_tuple(std::forward<Args>(args)...)}));
+    }
+
+    /**
+     * \brief Post work.
+     *
+     * If the pool is being destroyed and doesn't accept work anymore, the work of the
+     * strand runs in the calling thread instead.
+     * \param work Work to do.
+     */
+    void post(WorkUnit&& work);
+
+    /// \return Whether the calling thread is running work of this strand.
+    bool runningInThisThread() const;
+
+private:
+    std::shared_ptr<StrandState> m_state;
+} ;
+
+}
+
+#endif
@@ -101,7 +101,7 @@ void dumpMessage(const messagebus::Message& msg) {
 }
 
 void receive(messagebus::MessageBus* msgbus, int /*argc*/, char** /*argv*/) {
-    msgbus->receive(queue, [](messagebus::Message msg) { dumpMessage(msg); });
+    msgbus->receive(queue, [](const messagebus::Message& msg) { dumpMessage(msg); });
 
     // Wait until interrupt.
     setSignalHandler();
@@ -110,7 +110,7 @@ void receive(messagebus::MessageBus* msgbus, int /*argc*/, char** /*argv*/) {
 }
 
 void subscribe(messagebus::MessageBus* msgbus, int /*argc*/, char** /*argv*/) {
-    msgbus->subscribe(topic, [](messagebus::Message msg) { dumpMessage(msg); });
+    msgbus->subscribe(topic, [](const messagebus::Message& msg) { dumpMessage(msg); });
 
     // Wait until interrupt.
     setSignalHandler();
@@ -0,0 +1,47 @@
+/*  =========================================================================
+    fty_common_messagebus_async_dispatcher - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_messagebus_async_dispatcher -
+@discuss
+@end
+*/
+
+#include "fty_common_messagebus_classes.h"
+
+#include <exception>
+
+namespace messagebus {
+
+void logOffloadFailure(std::exception_ptr exception) {
+    try {
+        std::rethrow_exception(exception);
+    }
+    catch (std::exception& e) {
+        log_error("Uncaught exception in offloaded dispatch: %s", e.what());
+    }
+    catch (...) {
+        log_error("Uncaught exception in offloaded dispatch");
+    }
+}
+
+}
@@ -0,0 +1,194 @@
+/*  =========================================================================
+    fty_common_messagebus_bus_support - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_messagebus_bus_support -
+@discuss
+@end
+*/
+
+#include "fty_common_messagebus_classes.h"
+
+namespace messagebus {
+
+    SubscriptionHandle ListenerRegistry::add(const std::string& name, MessageListener messageListener) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        SubscriptionHandle handle = ++m_lastHandle;
+
+        auto listeners = std::make_shared<Listeners>();
+        auto iterator = m_listeners.find (name);
+        if (iterator != m_listeners.end ()) {
+            listeners->reserve (iterator->second->size() + 1);
+            *listeners = *iterator->second;
+        }
+        listeners->emplace_back (handle, std::move(messageListener));
+
+        m_listeners[name] = std::move(listeners);
+        m_names.emplace (handle, name);
+        return handle;
+    }
+
+    bool ListenerRegistry::remove(const std::string& name) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto iterator = m_listeners.find (name);
+        if (iterator == m_listeners.end ()) {
+            return false;
+        }
+
+        for (const auto& listener : *iterator->second) {
+            m_names.erase (listener.first);
+        }
+        m_listeners.erase (iterator);
+        return true;
+    }
+
+    std::string ListenerRegistry::remove(SubscriptionHandle handle) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto nameIterator = m_names.find (handle);
+
+        if (nameIterator == m_names.end ()) {
+            throw MessageBusException("Trying to unsubscribe with unknown subscription handle.");
+        }
+
+        auto iterator = m_listeners.find (nameIterator->second);
+        auto listeners = std::make_shared<Listeners>();
+        listeners->reserve (iterator->second->size());
+        for (const auto& listener : *iterator->second) {
+            if (listener.first != handle) {
+                listeners->push_back (listener);
+            }
+        }
+
+        std::string name = iterator->first;
+        if (listeners->empty()) {
+            m_listeners.erase (iterator);
+        }
+        else {
+            iterator->second = std::move(listeners);
+        }
+        m_names.erase (nameIterator);
+        return name;
+    }
+
+    bool ListenerRegistry::dispatch(const char *type, const std::string& name, const Message& message) const {
+        // Keep a reference on the current listeners, listeners may (un)subscribe while being called.
+        std::shared_ptr<const Listeners> listeners;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto iterator = m_listeners.find (name);
+            if (iterator != m_listeners.end ()) {
+                listeners = iterator->second;
+            }
+        }
+
+        if (!listeners) {
+            return false;
+        }
+
+        // The message is shared by all the listeners, none of them gets a copy.
+        for (const auto& listener : *listeners) {
+            try {
+                (listener.second)(message);
+            }
+            catch(const std::exception& e) {
+                log_error("Error in listener of %s '%s': '%s'", type, name.c_str(), e.what());
+            }
+            catch(...) {
+                log_error("Error in listener of %s '%s': 'unknown error'", type, name.c_str());
+            }
+        }
+        return true;
+    }
+
+    void PriorityNames::set(const std::string& name, Priority priority) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto names = m_names ? std::make_shared<std::set<std::string>>(*m_names) : std::make_shared<std::set<std::string>>();
+        if (priority == Priority::High) {
+            names->insert (name);
+        }
+        else {
+            names->erase (name);
+        }
+        std::atomic_store (&m_names, std::shared_ptr<const std::set<std::string>>(std::move(names)));
+    }
+
+    bool PriorityNames::isHigh(const std::string& name) const {
+        auto names = std::atomic_load (&m_names);
+        return names && names->count (name);
+    }
+
+    bool PriorityNames::any() const {
+        auto names = std::atomic_load (&m_names);
+        return names && !names->empty();
+    }
+
+    std::string requestRecipient(const std::string& clientName, const std::string& requestQueue, const Message& message) {
+        auto iterator = message.metaData().find(Message::CORRELATION_ID);
+        if( iterator == message.metaData().end() || iterator->second == "" ) {
+            log_warning("%s - request should have a correlation id", clientName.c_str());
+        }
+        iterator = message.metaData().find(Message::REPLY_TO);
+        if( iterator == message.metaData().end() || iterator->second == "" ) {
+            log_warning("%s - request should have a reply to field", clientName.c_str());
+        }
+        iterator = message.metaData().find(Message::TO);
+        if( iterator == message.metaData().end() || iterator->second == "" ) {
+            log_warning("%s - request should have a to field", clientName.c_str());
+            return requestQueue;
+        }
+        return iterator->second;
+    }
+
+    std::string requestReplyQueue(const Message& message) {
+        auto iterator = message.metaData().find(Message::REPLY_TO);
+        if( iterator == message.metaData().end() || iterator->second == "" ) {
+            throw MessageBusException("Request must have a reply to queue.");
+        }
+        return iterator->second;
+    }
+
+    void checkSyncRequest(const Message& message, std::string& correlationId, std::string& to) {
+        auto iterator = message.metaData().find(Message::CORRELATION_ID);
+        if( iterator == message.metaData().end() || iterator->second == "" ) {
+            throw MessageBusException("Request must have a correlation id.");
+        }
+        correlationId = iterator->second;
+        iterator = message.metaData().find(Message::TO);
+        if( iterator == message.metaData().end() || iterator->second == "" ) {
+            throw MessageBusException("Request must have a to field.");
+        }
+        to = iterator->second;
+    }
+
+    std::string replyRecipient(const std::string& clientName, const Message& message) {
+        auto iterator = message.metaData().find(Message::CORRELATION_ID);
+        if( iterator == message.metaData().end() || iterator->second == "" ) {
+            throw MessageBusException("Reply must have a correlation id.");
+        }
+        iterator = message.metaData().find(Message::TO);
+        if( iterator == message.metaData().end() || iterator->second == "" ) {
+            log_warning("%s - reply should have a to field", clientName.c_str());
+            return std::string();
+        }
+        return iterator->second;
+    }
+}
@@ -0,0 +1,192 @@
+/*  =========================================================================
+    fty_common_messagebus_bus_support - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_COMMON_MESSAGEBUS_BUS_SUPPORT_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_BUS_SUPPORT_H_INCLUDED
+
+#include <string>
+
+#include "fty_common_messagebus_interface.h"
+#include "fty_common_messagebus_message.h"
+#include "fty_common_messagebus_mpsc_queue.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace messagebus {
+
+    /**
+     * \brief Listeners of the topics and queues of a MessageBus backend.
+     *
+     * The listeners of a name are replaced (copy-on-write) on every change, so that
+     * the thread of the bus can dispatch without holding the lock while listeners
+     * are called, and listeners can (un)subscribe from there.
+     */
+    class ListenerRegistry {
+      public:
+        /**
+         * \brief Add a listener of a topic or a queue.
+         * \return Handle of the listener.
+         */
+        SubscriptionHandle add(const std::string& name, MessageListener messageListener);
+
+        /**
+         * \brief Remove all the listeners of a topic or a queue.
+         * \return false if there were none.
+         */
+        bool remove(const std::string& name);
+
+        /**
+         * \brief Remove a listener.
+         * \return Topic or queue the listener was added to.
+         * \throw MessageBusException if the handle is unknown.
+         */
+        std::string remove(SubscriptionHandle handle);
+
+        /**
+         * \brief Call the listeners of a topic or a queue, logging their exceptions.
+         * \param type "topic" or "queue", for the logs.
+         * \return false if there were no listeners.
+         */
+        bool dispatch(const char *type, const std::string& name, const Message& message) const;
+
+      private:
+        using Listeners = std::vector<std::pair<SubscriptionHandle, MessageListener>>;
+
+        mutable std::mutex m_mutex;
+        std::map<std::string, std::shared_ptr<const Listeners>> m_listeners;
+        std::unordered_map<SubscriptionHandle, std::string> m_names;
+        SubscriptionHandle m_lastHandle = 0;
+    };
+
+    /**
+     * \brief High priority topics and queues of a MessageBus backend.
+     *
+     * Replaced (copy-on-write) on every change, so that checking a name never waits
+     * for a change in progress.
+     */
+    class PriorityNames {
+      public:
+        void set(const std::string& name, Priority priority);
+        bool isHigh(const std::string& name) const;
+        /// \return Whether any name has a high priority.
+        bool any() const;
+
+      private:
+        std::mutex m_mutex;
+        std::shared_ptr<const std::set<std::string>> m_names;
+    };
+
+    /**
+     * \brief Normal and high priority lanes of items, popped by a single thread.
+     *
+     * Up to HIGH_PRIORITY_BURST high priority items are popped in a row while normal
+     * ones wait, so that a flood of high priority ones can't starve normal ones.
+     * With std::deque lanes, items are pushed by the popping thread too; with
+     * MpscQueue lanes, by any thread.
+     */
+    template <typename Item, typename Lane = std::deque<Item>>
+    class PriorityLanes {
+      public:
+        static constexpr unsigned HIGH_PRIORITY_BURST = 8;
+
+        void push(Item&& item, bool high) {
+            put(high ? m_high : m_normal, std::move(item));
+        }
+
+        bool pop(Item& item) {
+            if (m_highStreak < HIGH_PRIORITY_BURST && take(m_high, item)) {
+                m_highStreak++;
+                return true;
+            }
+            m_highStreak = 0;
+            return take(m_normal, item) || take(m_high, item);
+        }
+
+        // Only with std::deque lanes.
+        bool empty() const {
+            return m_high.empty() && m_normal.empty();
+        }
+
+        size_t size() const {
+            return m_high.size() + m_normal.size();
+        }
+
+      private:
+        static void put(std::deque<Item>& lane, Item&& item) {
+            lane.push_back(std::move(item));
+        }
+
+        static void put(MpscQueue<Item>& lane, Item&& item) {
+            lane.push(std::move(item));
+        }
+
+        static bool take(std::deque<Item>& lane, Item& item) {
+            if (lane.empty()) {
+                return false;
+            }
+            item = std::move(lane.front());
+            lane.pop_front();
+            return true;
+        }
+
+        static bool take(MpscQueue<Item>& lane, Item& item) {
+            return lane.pop(item);
+        }
+
+        Lane     m_high;
+        Lane     m_normal;
+        unsigned m_highStreak = 0;
+    };
+
+    /**
+     * \brief Recipient of an asynchronous request: its to field, or else its queue.
+     *
+     * Missing correlation id, reply to and to fields are logged.
+     */
+    std::string requestRecipient(const std::string& clientName, const std::string& requestQueue, const Message& message);
+
+    /**
+     * \brief Queue the replies of a request come back on.
+     * \throw MessageBusException if the request has no reply to field.
+     */
+    std::string requestReplyQueue(const Message& message);
+
+    /**
+     * \brief Correlation id and recipient of a synchronous request.
+     * \throw MessageBusException if the request has no correlation id or to field.
+     */
+    void checkSyncRequest(const Message& message, std::string& correlationId, std::string& to);
+
+    /**
+     * \brief Recipient of a reply, or an empty string (logged) if it has no to field.
+     * \throw MessageBusException if the reply has no correlation id.
+     */
+    std::string replyRecipient(const std::string& clientName, const Message& message);
+}
+
+#endif
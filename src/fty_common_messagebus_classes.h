@@ -34,12 +34,26 @@
 typedef struct _fty_common_messagebus_malamute_t fty_common_messagebus_malamute_t;
 #define FTY_COMMON_MESSAGEBUS_MALAMUTE_T_DEFINED
 #endif
+#ifndef FTY_COMMON_MESSAGEBUS_INPROCESS_T_DEFINED
+typedef struct _fty_common_messagebus_inprocess_t fty_common_messagebus_inprocess_t;
+#define FTY_COMMON_MESSAGEBUS_INPROCESS_T_DEFINED
+#endif
+#ifndef FTY_COMMON_MESSAGEBUS_SHARED_MEMORY_T_DEFINED
+typedef struct _fty_common_messagebus_shared_memory_t fty_common_messagebus_shared_memory_t;
+#define FTY_COMMON_MESSAGEBUS_SHARED_MEMORY_T_DEFINED
+#endif
 
 //  Extra headers
 
 //  Internal API
 
+#include "fty_common_messagebus_bus_support.h"
+#include "fty_common_messagebus_event_count.h"
+#include "fty_common_messagebus_histogram.h"
+#include "fty_common_messagebus_inprocess.h"
+#include "fty_common_messagebus_mpsc_queue.h"
 #include "fty_common_messagebus_malamute.h"
+#include "fty_common_messagebus_shared_memory.h"
 
 
 #endif
@@ -0,0 +1,138 @@
+/*  =========================================================================
+    fty_common_messagebus_event_count - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_COMMON_MESSAGEBUS_EVENT_COUNT_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_EVENT_COUNT_H_INCLUDED
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace messagebus {
+
+/**
+ * \brief Event count, to sleep until a condition checked without locks may have changed.
+ *
+ * Waiters announce themselves with prepareWait(), check their condition a last time,
+ * then either cancelWait() or wait(). Notifiers change the condition, then call
+ * notifyOne() or notifyAll() which are a single atomic load if nobody waits. Waiting
+ * is done on a futex, notifying never takes a lock.
+ */
+class EventCount {
+public:
+    EventCount() : m_epoch(0), m_waiters(0) { }
+
+    EventCount(const EventCount&) = delete;
+    EventCount& operator=(const EventCount&) = delete;
+
+    /**
+     * \brief Announce a wait, before checking the condition a last time.
+     * \return Key to wait with.
+     */
+    uint32_t prepareWait() {
+        m_waiters.fetch_add(1);
+        // Order the announcement before the last check of the condition.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_epoch.load();
+    }
+
+    /// \brief Cancel an announced wait, the condition changed.
+    void cancelWait() {
+        m_waiters.fetch_sub(1);
+    }
+
+    /**
+     * \brief Wait for a notification since prepareWait().
+     * \param key Key returned by prepareWait().
+     */
+    void wait(uint32_t key) {
+        while (m_epoch.load() == key) {
+            futex(FUTEX_WAIT_PRIVATE, key, nullptr);
+        }
+        m_waiters.fetch_sub(1);
+    }
+
+    /**
+     * \brief Wait for a notification since prepareWait(), for some time.
+     * \param key Key returned by prepareWait().
+     * \param timeout How long to wait at most.
+     * \return false if the wait timed out.
+     */
+    bool waitFor(uint32_t key, std::chrono::nanoseconds timeout) {
+        timespec ts;
+        ts.tv_sec  = time_t(timeout.count() / 1000000000);
+        ts.tv_nsec = long(timeout.count() % 1000000000);
+
+        bool notified = true;
+        while (m_epoch.load() == key) {
+            if (futex(FUTEX_WAIT_PRIVATE, key, &ts) != 0 && errno == ETIMEDOUT) {
+                notified = m_epoch.load() != key;
+                break;
+            }
+        }
+        m_waiters.fetch_sub(1);
+        return notified;
+    }
+
+    /// \brief Number of announced waits.
+    uint32_t waiters() const {
+        return m_waiters.load();
+    }
+
+    /// \brief Wake up one waiter, if any (the condition must be changed before).
+    void notifyOne() {
+        notify(1);
+    }
+
+    /// \brief Wake up all the waiters, if any (the condition must be changed before).
+    void notifyAll() {
+        notify(INT_MAX);
+    }
+
+private:
+    void notify(int count) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load()) {
+            m_epoch.fetch_add(1);
+            futex(FUTEX_WAKE_PRIVATE, uint32_t(count), nullptr);
+        }
+    }
+
+    long futex(int op, uint32_t value, const timespec* timeout) {
+        static_assert(sizeof(m_epoch) == sizeof(uint32_t), "futex word must be 32 bits");
+        return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), op, value, timeout, nullptr, 0);
+    }
+
+    // Incremented on each notification, waiters sleep while it's unchanged.
+    std::atomic<uint32_t> m_epoch;
+    std::atomic<uint32_t> m_waiters;
+} ;
+
+}
+
+#endif
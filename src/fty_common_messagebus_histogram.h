@@ -0,0 +1,79 @@
+/*  =========================================================================
+    fty_common_messagebus_histogram - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_COMMON_MESSAGEBUS_HISTOGRAM_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_HISTOGRAM_H_INCLUDED
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "fty_common_messagebus_pool_worker.h"
+
+namespace messagebus {
+
+/// \brief Raise an atomic maximum to value, if it's larger.
+inline void atomicMax(std::atomic<int64_t>& max, int64_t value) {
+    int64_t current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * \brief Distribution of durations, recorded with relaxed atomics.
+ *
+ * Buckets are the ones of PoolWorker::Histogram, which snapshots are added to.
+ */
+class AtomicHistogram {
+public:
+    /// \brief Record a duration, in nanoseconds.
+    void record(int64_t duration) {
+        duration = std::max<int64_t>(duration, 0);
+        uint64_t micros = uint64_t(duration / 1000);
+        size_t bucket = micros ? size_t(64 - __builtin_clzll(micros)) : 0;
+        m_buckets[std::min(bucket, m_buckets.size() - 1)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_total.fetch_add(duration, std::memory_order_relaxed);
+        atomicMax(m_max, duration);
+    }
+
+    /// \brief Add the durations recorded to a snapshot.
+    void addTo(PoolWorker::Histogram& histogram) const {
+        for (size_t bucket = 0; bucket < m_buckets.size(); bucket++) {
+            histogram.buckets[bucket] += m_buckets[bucket].load(std::memory_order_relaxed);
+        }
+        histogram.count += m_count.load(std::memory_order_relaxed);
+        histogram.total += std::chrono::nanoseconds(m_total.load(std::memory_order_relaxed));
+        histogram.max = std::max(histogram.max, std::chrono::nanoseconds(m_max.load(std::memory_order_relaxed)));
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, PoolWorker::Histogram::BUCKETS> m_buckets {};
+    std::atomic<uint64_t> m_count {0};
+    std::atomic<int64_t> m_total {0};
+    std::atomic<int64_t> m_max {0};
+} ;
+
+}
+
+#endif
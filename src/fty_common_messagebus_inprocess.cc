@@ -0,0 +1,353 @@
+/*  =========================================================================
+    fty_common_messagebus_inprocess - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_messagebus_inprocess -
+@discuss
+@end
+*/
+
+#include "fty_common_messagebus_classes.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+
+namespace messagebus {
+
+    /**
+     * \brief Broker of the in-process message buses of an endpoint.
+     *
+     * Only routes: deliveries are queued to the recipients under m_mutex, so that a
+     * client detached can't be delivered to anymore.
+     */
+    class InProcessBroker {
+      public:
+        static std::shared_ptr<InProcessBroker> get(const std::string& endpoint) {
+            static std::mutex mutex;
+            static std::map<std::string, std::weak_ptr<InProcessBroker>> brokers;
+
+            std::unique_lock<std::mutex> lock(mutex);
+            auto& broker = brokers[endpoint];
+            auto shared = broker.lock();
+            if (!shared) {
+                shared = std::make_shared<InProcessBroker>();
+                broker = shared;
+            }
+            return shared;
+        }
+
+        void attach(MessageBusInProcess *client) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (!m_clients.emplace(client->clientName(), client).second) {
+                throw MessageBusException("Client name already connected.");
+            }
+        }
+
+        void detach(MessageBusInProcess *client) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto iterator = m_clients.find(client->clientName());
+            if (iterator != m_clients.end() && iterator->second == client) {
+                m_clients.erase(iterator);
+            }
+            for (auto consumers = m_consumers.begin(); consumers != m_consumers.end();) {
+                consumers->second.erase(std::remove(consumers->second.begin(), consumers->second.end(), client), consumers->second.end());
+                consumers = consumers->second.empty() ? m_consumers.erase(consumers) : std::next(consumers);
+            }
+        }
+
+        void consume(MessageBusInProcess *client, const std::string& topic) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto& consumers = m_consumers[topic];
+            if (std::find(consumers.begin(), consumers.end(), client) == consumers.end()) {
+                consumers.push_back(client);
+            }
+        }
+
+        void stopConsuming(MessageBusInProcess *client, const std::string& topic) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto consumers = m_consumers.find(topic);
+            if (consumers != m_consumers.end()) {
+                consumers->second.erase(std::remove(consumers->second.begin(), consumers->second.end(), client), consumers->second.end());
+                if (consumers->second.empty()) {
+                    m_consumers.erase(consumers);
+                }
+            }
+        }
+
+        void publish(const std::string& topic, const std::shared_ptr<const Message>& message) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto consumers = m_consumers.find(topic);
+            if (consumers != m_consumers.end()) {
+                for (auto consumer : consumers->second) {
+                    consumer->deliver("topic", topic, message);
+                }
+            }
+        }
+
+        bool sendTo(const std::string& to, const std::string& subject, const std::shared_ptr<const Message>& message) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto client = m_clients.find(to);
+            if (client == m_clients.end()) {
+                return false;
+            }
+            client->second->deliver("queue", subject, message);
+            return true;
+        }
+
+      private:
+        std::mutex m_mutex;
+        std::unordered_map<std::string, MessageBusInProcess*> m_clients;
+        std::unordered_map<std::string, std::vector<MessageBusInProcess*>> m_consumers;
+    };
+
+    MessageBusInProcess::MessageBusInProcess(const std::string& endpoint, const std::string& clientName):
+        m_broker(InProcessBroker::get(endpoint)),
+        m_clientName(clientName)
+    {
+    }
+
+    MessageBusInProcess::~MessageBusInProcess() {
+        // Once detached, nothing can be delivered anymore.
+        m_broker->detach(this);
+        if (m_dispatcher.joinable()) {
+            m_stopping = true;
+            m_wakeup.notifyAll();
+            m_dispatcher.join();
+        }
+    }
+
+    void MessageBusInProcess::connect() {
+        if (m_connected) {
+            throw MessageBusException("Already connected.");
+        }
+        m_broker->attach(this);
+        m_dispatcher = std::thread(&MessageBusInProcess::dispatcherMainloop, this);
+        m_connected = true;
+        log_trace ("%s - connected to in-process broker", m_clientName.c_str());
+    }
+
+    void MessageBusInProcess::publish(const std::string& topic, const Message& message) {
+        publish (topic, message, SendCompletion());
+    }
+
+    void MessageBusInProcess::publish(const std::string& topic, const Message& message, SendCompletion completion) {
+        if (!m_connected) {
+            throw MessageBusException("Not connected.");
+        }
+
+        // One copy, shared by all the subscribers.
+        log_trace ("%s - publishing on topic '%s'", m_clientName.c_str(), topic.c_str());
+        m_broker->publish (topic, std::make_shared<const Message>(message));
+        complete (std::move(completion), true);
+    }
+
+    SubscriptionHandle MessageBusInProcess::subscribe(const std::string& topic, MessageListener messageListener) {
+        m_broker->consume (this, topic);
+        SubscriptionHandle handle = m_listeners.add (topic, messageListener);
+        log_trace ("%s - subscribed to topic '%s'", m_clientName.c_str(), topic.c_str());
+        return handle;
+    }
+
+    void MessageBusInProcess::unsubscribe(const std::string& topic, MessageListener /*messageListener*/) {
+        if (!m_listeners.remove (topic)) {
+            throw MessageBusException("Trying to unsubscribe on non-subscribed topic.");
+        }
+
+        m_broker->stopConsuming (this, topic);
+        log_trace ("%s - unsubscribed to topic '%s'", m_clientName.c_str(), topic.c_str());
+    }
+
+    void MessageBusInProcess::unsubscribe(SubscriptionHandle handle) {
+        std::string name = m_listeners.remove (handle);
+        log_trace ("%s - removed listener %" PRIu64 " of '%s'", m_clientName.c_str(), handle, name.c_str());
+    }
+
+    void MessageBusInProcess::sendRequest(const std::string& requestQueue, const Message& message) {
+        sendRequest (requestQueue, message, SendCompletion());
+    }
+
+    void MessageBusInProcess::sendRequest(const std::string& requestQueue, const Message& message, SendCompletion completion) {
+        sendMailbox (requestRecipient (m_clientName, requestQueue, message), requestQueue, message, std::move(completion));
+    }
+
+    void MessageBusInProcess::sendRequest(const std::string& requestQueue, const Message& message, MessageListener messageListener) {
+        receive(requestReplyQueue(message), messageListener);
+        sendRequest(requestQueue, message);
+    }
+
+    void MessageBusInProcess::sendReply(const std::string& replyQueue, const Message& message) {
+        sendReply (replyQueue, message, SendCompletion());
+    }
+
+    void MessageBusInProcess::sendReply(const std::string& replyQueue, const Message& message, SendCompletion completion) {
+        std::string to = replyRecipient (m_clientName, message);
+        if (to.empty()) {
+            complete (std::move(completion), false);
+            return;
+        }
+
+        sendMailbox (to, replyQueue, message, std::move(completion));
+    }
+
+    SubscriptionHandle MessageBusInProcess::receive(const std::string& queue, MessageListener messageListener) {
+        SubscriptionHandle handle = m_listeners.add (queue, messageListener);
+        log_trace ("%s - receive from queue '%s'", m_clientName.c_str(), queue.c_str());
+        return handle;
+    }
+
+    void MessageBusInProcess::setPriority(const std::string& name, Priority priority) {
+        m_priorities.set (name, priority);
+        log_trace ("%s - '%s' set to %s priority", m_clientName.c_str(), name.c_str(), priority == Priority::High ? "high" : "normal");
+    }
+
+    Message MessageBusInProcess::request(const std::string& requestQueue, const Message & message, int receiveTimeOut) {
+        if (!m_connected) {
+            throw MessageBusException("Not connected.");
+        }
+
+        std::string correlationId, to;
+        checkSyncRequest (message, correlationId, to);
+
+        auto msg = std::make_shared<Message>(message);
+        // Adding metadata timeout.
+        msg->metaData().emplace(Message::TIMEOUT, std::to_string(receiveTimeOut));
+        msg->metaData().emplace(Message::REPLY_TO, m_clientName);
+
+        // Register before sending, the reply may come back before we wait for it.
+        SyncRequest syncRequest;
+        std::unique_lock<std::mutex> lock(m_cv_mtx);
+        if (!m_syncRequests.emplace (correlationId, &syncRequest).second) {
+            throw MessageBusException("Request with same correlation id already pending.");
+        }
+        lock.unlock();
+
+        bool sent = m_broker->sendTo (to, requestQueue, std::move(msg));
+
+        lock.lock();
+        bool replied = sent && m_cv.wait_for(lock, std::chrono::seconds(receiveTimeOut), [&syncRequest]() { return syncRequest.replied; });
+        m_syncRequests.erase (correlationId);
+        if (!sent) {
+            throw MessageBusException("Request recipient not connected.");
+        }
+        if (!replied) {
+            throw MessageBusException("Request timed out.");
+        }
+        return std::move(syncRequest.response);
+    }
+
+    void MessageBusInProcess::deliver(const char *type, const std::string& name, const std::shared_ptr<const Message>& message) {
+        // Replies to synchronous requests are handed over right away, even while the
+        // dispatcher thread is busy (possibly with the listener waiting for them).
+        if (std::strcmp (type, "queue") == 0) {
+            auto iterator = message->metaData().find(Message::CORRELATION_ID);
+            if( iterator != message->metaData().end() ) {
+                std::unique_lock<std::mutex> lock(m_cv_mtx);
+                auto syncRequest = m_syncRequests.find(iterator->second);
+                if( syncRequest != m_syncRequests.end() && !syncRequest->second->replied ) {
+                    syncRequest->second->response = *message;
+                    syncRequest->second->replied = true;
+                    m_cv.notify_all();
+                    return;
+                }
+            }
+        }
+
+        Delivery delivery;
+        delivery.type = type;
+        delivery.name = name;
+        delivery.message = message;
+        push (std::move(delivery));
+    }
+
+    void MessageBusInProcess::sendMailbox(const std::string& to, const std::string& subject, const Message& message, SendCompletion completion) {
+        if (!m_connected) {
+            throw MessageBusException("Not connected.");
+        }
+
+        bool sent = m_broker->sendTo (to, subject, std::make_shared<const Message>(message));
+        if (!sent) {
+            log_warning("%s - '%s' is not connected, message to '%s' dropped", m_clientName.c_str(), to.c_str(), subject.c_str());
+        }
+        complete (std::move(completion), sent);
+    }
+
+    void MessageBusInProcess::complete(SendCompletion&& completion, bool sent) {
+        // Completions are called from the dispatcher thread, like for the other buses.
+        if (completion) {
+            Delivery delivery;
+            delivery.completion = std::move(completion);
+            delivery.sent = sent;
+            push (std::move(delivery));
+        }
+    }
+
+    void MessageBusInProcess::push(Delivery&& delivery) {
+        bool high = delivery.message && m_priorities.isHigh (delivery.name);
+        m_deliveries.push (std::move(delivery), high);
+        m_wakeup.notifyOne ();
+    }
+
+    void MessageBusInProcess::dispatcherMainloop() {
+        log_trace ("%s - dispatcher mainloop ready", m_clientName.c_str());
+
+        Delivery delivery;
+        for (;;) {
+            if (!m_deliveries.pop (delivery)) {
+                uint32_t key = m_wakeup.prepareWait ();
+                if (!m_deliveries.pop (delivery)) {
+                    if (m_stopping) {
+                        m_wakeup.cancelWait ();
+                        break;
+                    }
+                    m_wakeup.wait (key);
+                    continue;
+                }
+                m_wakeup.cancelWait ();
+            }
+
+            if (delivery.message) {
+                if (!m_listeners.dispatch (delivery.type, delivery.name, *delivery.message) && std::strcmp (delivery.type, "queue") == 0) {
+                    log_warning("Message skipped");
+                }
+            }
+            else {
+                try {
+                    delivery.completion (delivery.sent);
+                }
+                catch (const std::exception& e) {
+                    log_error("Error in send completion: '%s'", e.what());
+                }
+                catch (...) {
+                    log_error("Error in send completion: 'unknown error'");
+                }
+            }
+            delivery = Delivery();
+        }
+
+        log_debug ("%s - dispatcher mainloop terminated", m_clientName.c_str());
+    }
+
+    MessageBus* InProcessMessageBus(const std::string& endpoint, const std::string& clientName) {
+        return new messagebus::MessageBusInProcess(endpoint, clientName);
+    }
+}
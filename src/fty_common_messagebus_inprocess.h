@@ -0,0 +1,131 @@
+/*  =========================================================================
+    fty_common_messagebus_inprocess - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_COMMON_MESSAGEBUS_INPROCESS_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_INPROCESS_H_INCLUDED
+
+#include <string>
+
+#include "fty_common_messagebus_interface.h"
+#include "fty_common_messagebus_exception.h"
+#include "fty_common_messagebus_message.h"
+#include "fty_common_messagebus_bus_support.h"
+#include "fty_common_messagebus_event_count.h"
+#include "fty_common_messagebus_mpsc_queue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace messagebus {
+
+    class InProcessBroker;
+
+    /**
+     * \brief Message bus between the clients of an in-process broker.
+     *
+     * Addressing is the one of MessageBusMalamute: topics are streams delivered to
+     * every subscribed client, queues are the subjects of mailbox messages addressed
+     * to a client by name. Messages are never serialized, a message published to
+     * several clients is copied once and shared. Each client dispatches what it
+     * receives in order, in its own thread.
+     */
+    class MessageBusInProcess : public MessageBus {
+      public:
+        MessageBusInProcess(const std::string& endpoint, const std::string& clientName);
+        ~MessageBusInProcess();
+
+        void connect() override;
+
+         // Async topic
+        void publish(const std::string& topic, const Message& message) override;
+        void publish(const std::string& topic, const Message& message, SendCompletion completion) override;
+        SubscriptionHandle subscribe(const std::string& topic, MessageListener messageListener) override;
+        void unsubscribe(const std::string& topic, MessageListener messageListener) override;
+        void unsubscribe(SubscriptionHandle handle) override;
+
+        // Async queue
+        void sendRequest(const std::string& requestQueue, const Message& message) override;
+        void sendRequest(const std::string& requestQueue, const Message& message, SendCompletion completion) override;
+        void sendRequest(const std::string& requestQueue, const Message& message, MessageListener messageListener) override;
+        void sendReply(const std::string& replyQueue, const Message& message) override;
+        void sendReply(const std::string& replyQueue, const Message& message, SendCompletion completion) override;
+        SubscriptionHandle receive(const std::string& queue, MessageListener messageListener) override;
+
+        void setPriority(const std::string& name, Priority priority) override;
+
+        // Sync queue
+        Message request(const std::string& requestQueue, const Message& message, int receiveTimeOut) override;
+
+        /**
+         * \brief Queue a message delivered by the broker.
+         * \param type "topic" or "queue".
+         * \param name Topic or queue.
+         * \param message Message, shared with the other recipients.
+         */
+        void deliver(const char *type, const std::string& name, const std::shared_ptr<const Message>& message);
+
+        const std::string& clientName() const { return m_clientName; }
+
+      private:
+        // Message to dispatch, or completion of a send to call, in the dispatcher thread.
+        struct Delivery {
+            const char *type = nullptr;
+            std::string name;
+            std::shared_ptr<const Message> message;
+            SendCompletion completion;
+            bool sent = false;
+        };
+
+        // Pending synchronous request, filled when its reply is delivered.
+        struct SyncRequest {
+            bool    replied = false;
+            Message response;
+        };
+
+        void sendMailbox(const std::string& to, const std::string& subject, const Message& message, SendCompletion completion);
+        void complete(SendCompletion&& completion, bool sent);
+        void push(Delivery&& delivery);
+        void dispatcherMainloop();
+
+        std::shared_ptr<InProcessBroker> m_broker;
+        std::string m_clientName;
+        std::atomic<bool> m_connected{false};
+
+        // Deliveries, in two priority lanes, popped by the dispatcher thread only.
+        PriorityLanes<Delivery, MpscQueue<Delivery>> m_deliveries;
+        EventCount          m_wakeup;
+        std::atomic<bool>   m_stopping{false};
+        std::thread         m_dispatcher;
+
+        ListenerRegistry m_listeners;
+        PriorityNames    m_priorities;
+
+        std::condition_variable m_cv;
+        std::mutex m_cv_mtx;
+        std::map<std::string, SyncRequest*> m_syncRequests;
+    };
+}
+
+#endif
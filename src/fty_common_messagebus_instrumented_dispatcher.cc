@@ -0,0 +1,84 @@
+/*  =========================================================================
+    fty_common_messagebus_instrumented_dispatcher - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_messagebus_instrumented_dispatcher -
+@discuss
+@end
+*/
+
+#include "fty_common_messagebus_classes.h"
+
+#include <vector>
+
+namespace messagebus {
+
+/**
+ * \brief Counters of a DispatchMetrics, one slot per key.
+ */
+class DispatchMetricsState {
+public:
+    DispatchMetricsState(size_t keys) : m_slots(keys) { }
+
+    void record(size_t key, std::chrono::nanoseconds latency, bool error) {
+        auto& slot = m_slots[key];
+        slot.calls.fetch_add(1, std::memory_order_relaxed);
+        if (error) {
+            slot.errors.fetch_add(1, std::memory_order_relaxed);
+        }
+        slot.latency.record(latency.count());
+    }
+
+    DispatchStats stats(size_t key) const {
+        const auto& slot = m_slots[key];
+        DispatchStats stats;
+        stats.calls  = slot.calls.load(std::memory_order_relaxed);
+        stats.errors = slot.errors.load(std::memory_order_relaxed);
+        slot.latency.addTo(stats.latency);
+        return stats;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> calls {0};
+        std::atomic<uint64_t> errors {0};
+        AtomicHistogram latency;
+    } ;
+
+    std::vector<Slot> m_slots;
+} ;
+
+DispatchMetrics::DispatchMetrics(size_t keys) : m_state(new DispatchMetricsState(keys)) {
+}
+
+DispatchMetrics::~DispatchMetrics() {
+}
+
+void DispatchMetrics::record(size_t key, std::chrono::nanoseconds latency, bool error) {
+    m_state->record(key, latency, error);
+}
+
+DispatchStats DispatchMetrics::stats(size_t key) const {
+    return m_state->stats(key);
+}
+
+}
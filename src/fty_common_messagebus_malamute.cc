@@ -29,6 +29,9 @@
 #include "fty_common_messagebus_malamute.h"
 #include "fty_common_messagebus_message.h"
 
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
 #include <new>
 #include <thread>
 
@@ -92,11 +95,33 @@ namespace messagebus {
             throw std::bad_alloc();
         }
 
+        // Doorbell of the outbox, rung by senders to wake up the listener thread.
+        char doorbellEndpoint[64];
+        snprintf (doorbellEndpoint, sizeof(doorbellEndpoint), "inproc://messagebus-outbox-%p", static_cast<void*>(this));
+        m_doorbellListener = zsock_new_pair ((std::string("@") + doorbellEndpoint).c_str());
+        m_doorbell = zsock_new_pair ((std::string(">") + doorbellEndpoint).c_str());
+        if (!m_doorbellListener || !m_doorbell) {
+            zsock_destroy (&m_doorbell);
+            zsock_destroy (&m_doorbellListener);
+            mlm_client_destroy(&m_client);
+            throw std::bad_alloc();
+        }
+
         zsys_handler_set (nullptr);
     }
 
     MessageBusMalamute::~MessageBusMalamute() {
         zactor_destroy(&m_actor);
+
+        // Drop what was posted after the listener thread flushed the outbox for the last time.
+        Outgoing outgoing;
+        while (m_outbox.pop (outgoing)) {
+            zmsg_destroy (&outgoing.content);
+            complete (outgoing, false);
+        }
+        zsock_destroy (&m_doorbell);
+        zsock_destroy (&m_doorbellListener);
+
         mlm_client_destroy(&m_client);
     }
 
@@ -105,7 +130,6 @@ namespace messagebus {
         if (mlm_client_connect (m_client, m_endpoint.c_str(), 1000, m_clientName.c_str()) == -1) {
             throw MessageBusException("Failed to connect to Malamute server.");
         }
-        log_trace ("%s - connected to Malamute server", m_clientName.c_str());
 
         // Create listener thread.
         m_actor = zactor_new (listener, reinterpret_cast<void*>(this));
@@ -115,135 +139,135 @@ namespace messagebus {
     }
 
     void MessageBusMalamute::publish(const std::string& topic, const Message& message) {
-        if( m_publishTopic == "" ) {
-            m_publishTopic = topic;
-            if (mlm_client_set_producer (m_client, m_publishTopic.c_str()) == -1) {
-                throw MessageBusException("Failed to set producer on Malamute connection.");
-            }
-            log_trace ("%s - registered as stream producter on '%s'", m_clientName.c_str(), m_publishTopic.c_str());
-        }
+        publish (topic, message, SendCompletion());
+    }
 
-        if( topic != m_publishTopic ) {
-            throw MessageBusException("MessageBusMalamute requires publishing to declared topic.");
-        }
+    void MessageBusMalamute::publish(const std::string& topic, const Message& message, SendCompletion completion) {
+        Outgoing outgoing;
+        outgoing.stream = true;
+        outgoing.address = topic;
+        outgoing.content = _toZmsg (message);
+        outgoing.completion = std::move(completion);
+
+        log_trace ("%s - publishing on topic '%s'", m_clientName.c_str(), topic.c_str());
+        post (std::move(outgoing));
+    }
+
+    void MessageBusMalamute::setPriority(const std::string& name, Priority priority) {
+        m_priorities.set (name, priority);
+        log_trace ("%s - '%s' set to %s priority", m_clientName.c_str(), name.c_str(), priority == Priority::High ? "high" : "normal");
+    }
+
+    void MessageBusMalamute::post(Outgoing&& outgoing) {
+        bool high = m_priorities.isHigh (outgoing.stream ? outgoing.address : outgoing.subject);
+        m_outbox.push (std::move(outgoing), high);
 
-        zmsg_t *msg = _toZmsg (message);
-        log_trace ("%s - publishing on topic '%s'", m_clientName.c_str(), m_publishTopic.c_str());
-        mlm_client_send (m_client, topic.c_str(), &msg);
+        // Only the sender that finds the listener thread idle rings the doorbell.
+        if (m_outboxIdle.exchange (false)) {
+            std::unique_lock<std::mutex> lock(m_doorbellMutex);
+            zsock_signal (m_doorbell, 0);
+        }
     }
 
-    void MessageBusMalamute::subscribe(const std::string& topic, MessageListener messageListener) {
-        if (mlm_client_set_consumer (m_client, topic.c_str(), "") == -1) {
-            throw MessageBusException("Failed to set consumer on Malamute connection.");
+    SubscriptionHandle MessageBusMalamute::subscribe(const std::string& topic, MessageListener messageListener) {
+        {
+            std::unique_lock<std::mutex> lock(m_clientMutex);
+            if (mlm_client_set_consumer (m_client, topic.c_str(), "") == -1) {
+                throw MessageBusException("Failed to set consumer on Malamute connection.");
+            }
         }
 
-        m_subscriptions.emplace (topic, messageListener);
+        SubscriptionHandle handle = m_listeners.add (topic, messageListener);
         log_trace ("%s - subscribed to topic '%s'", m_clientName.c_str(), topic.c_str());
+        return handle;
     }
 
     void MessageBusMalamute::unsubscribe(const std::string& topic, MessageListener /*messageListener*/) {
-        auto iterator = m_subscriptions.find (topic);
-
-        if (iterator == m_subscriptions.end ()) {
+        if (!m_listeners.remove (topic)) {
             throw MessageBusException("Trying to unsubscribe on non-subscribed topic.");
         }
 
         // Our current Malamute version is too old...
         log_warning ("%s - mlm_client_remove_consumer() not implemented", m_clientName.c_str());
-
-        m_subscriptions.erase (iterator);
         log_trace ("%s - unsubscribed to topic '%s'", m_clientName.c_str(), topic.c_str());
     }
 
-    void MessageBusMalamute::sendRequest(const std::string& requestQueue, const Message& message) {
-        std::string to = requestQueue.c_str();
-        std::string subject = requestQueue.c_str();
+    void MessageBusMalamute::unsubscribe(SubscriptionHandle handle) {
+        std::string name = m_listeners.remove (handle);
+        log_trace ("%s - removed listener %" PRIu64 " of '%s'", m_clientName.c_str(), handle, name.c_str());
+    }
 
-        auto iterator = message.metaData().find(Message::CORRELATION_ID);
-        if( iterator == message.metaData().end() || iterator->second == "" ) {
-            log_warning("%s - request should have a correlation id", m_clientName.c_str());
-        }
-        iterator = message.metaData().find(Message::REPLY_TO);
-        if( iterator == message.metaData().end() || iterator->second == "" ) {
-            log_warning("%s - request should have a reply to field", m_clientName.c_str());
-        }
-        iterator = message.metaData().find(Message::TO);
-        if( iterator == message.metaData().end() || iterator->second == "" ) {
-            log_warning("%s - request should have a to field", m_clientName.c_str());
-        } else {
-            to = iterator->second;
-            subject = requestQueue;
-        }
-        zmsg_t *msg = _toZmsg (message);
+    void MessageBusMalamute::sendRequest(const std::string& requestQueue, const Message& message) {
+        sendRequest (requestQueue, message, SendCompletion());
+    }
 
-        //Todo: Check error code after sendto
-        mlm_client_sendto (m_client, to.c_str(), subject.c_str(), nullptr, 200, &msg);
+    void MessageBusMalamute::sendRequest(const std::string& requestQueue, const Message& message, SendCompletion completion) {
+        Outgoing outgoing;
+        outgoing.address = requestRecipient (m_clientName, requestQueue, message);
+        outgoing.subject = requestQueue;
+        outgoing.content = _toZmsg (message);
+        outgoing.completion = std::move(completion);
+        post (std::move(outgoing));
     }
 
     void MessageBusMalamute::sendRequest(const std::string& requestQueue, const Message& message, MessageListener messageListener) {
-        auto iterator = message.metaData().find(Message::REPLY_TO);
-        if( iterator == message.metaData().end() || iterator->second == "" ) {
-            throw MessageBusException("Request must have a reply to queue.");
-        }
-        std::string queue(iterator->second);
-        receive(queue, messageListener);
+        receive(requestReplyQueue(message), messageListener);
         sendRequest(requestQueue, message);
     }
 
     void MessageBusMalamute::sendReply(const std::string& replyQueue, const Message& message) {
-        auto iterator = message.metaData().find(Message::CORRELATION_ID);
-        if( iterator == message.metaData().end() || iterator->second == "" ) {
-            throw MessageBusException("Reply must have a correlation id.");
-        }
-        iterator = message.metaData().find(Message::TO);
-        if( iterator == message.metaData().end() || iterator->second == "" ) {
-            log_warning("%s - request should have a to field", m_clientName.c_str());
-        }
-        zmsg_t *msg = _toZmsg (message);
-
-        //Todo: Check error code after sendto
-        mlm_client_sendto (m_client, iterator->second.c_str(), replyQueue.c_str(), nullptr, 200, &msg);
+        sendReply (replyQueue, message, SendCompletion());
     }
 
-    void MessageBusMalamute::receive(const std::string& queue, MessageListener messageListener) {
-        auto iterator = m_subscriptions.find (queue);
-        if (iterator != m_subscriptions.end ()) {
-            throw MessageBusException("Already have queue map to listener");
+    void MessageBusMalamute::sendReply(const std::string& replyQueue, const Message& message, SendCompletion completion) {
+        Outgoing outgoing;
+        outgoing.address = replyRecipient (m_clientName, message);
+        outgoing.subject = replyQueue;
+        outgoing.completion = std::move(completion);
+        // Without anybody to address it to, the completion still gets called with false.
+        if (!outgoing.address.empty()) {
+            outgoing.content = _toZmsg (message);
         }
-        m_subscriptions.emplace (queue, messageListener);
+        post (std::move(outgoing));
+    }
+
+    SubscriptionHandle MessageBusMalamute::receive(const std::string& queue, MessageListener messageListener) {
+        SubscriptionHandle handle = m_listeners.add (queue, messageListener);
         log_trace ("%s - receive from queue '%s'", m_clientName.c_str(), queue.c_str());
+        return handle;
     }
 
     Message MessageBusMalamute::request(const std::string& requestQueue, const Message & message, int receiveTimeOut) {
         
-        auto iterator = message.metaData().find(Message::CORRELATION_ID);
-
-        if( iterator == message.metaData().end() || iterator->second == "" ) {
-            throw MessageBusException("Request must have a correlation id.");
-        }
-        m_syncUuid = iterator->second;
-        iterator = message.metaData().find(Message::TO);
-        if( iterator == message.metaData().end() || iterator->second == "" ) {
-            throw MessageBusException("Request must have a to field.");
-        }
+        std::string correlationId, to;
+        checkSyncRequest (message, correlationId, to);
 
         Message msg(message);
         // Adding metadata timeout.
         msg.metaData().emplace(Message::TIMEOUT, std::to_string(receiveTimeOut));
-
-        std::unique_lock<std::mutex> lock(m_cv_mtx);
         msg.metaData().emplace(Message::REPLY_TO, m_clientName);
-        zmsg_t *msgMlm = _toZmsg (msg);
-
-        //Todo: Check error code after sendto
-        mlm_client_sendto (m_client, iterator->second.c_str(), requestQueue.c_str(), nullptr, 200, &msgMlm);
 
-        if(m_cv.wait_for(lock, std::chrono::seconds(receiveTimeOut)) == std::cv_status::timeout) {
-            throw MessageBusException("Request timed out.");
+        // Register before sending, the reply may come back before we wait for it.
+        SyncRequest syncRequest;
+        std::unique_lock<std::mutex> lock(m_cv_mtx);
+        if (!m_syncRequests.emplace (correlationId, &syncRequest).second) {
+            throw MessageBusException("Request with same correlation id already pending.");
         }
-        else {
-            return m_syncResponse;
+        lock.unlock();
+
+        Outgoing outgoing;
+        outgoing.address = to;
+        outgoing.subject = requestQueue;
+        outgoing.content = _toZmsg (msg);
+        post (std::move(outgoing));
+
+        lock.lock();
+        bool replied = m_cv.wait_for(lock, std::chrono::seconds(receiveTimeOut), [&syncRequest]() { return syncRequest.replied; });
+        m_syncRequests.erase (correlationId);
+        if (!replied) {
+            throw MessageBusException("Request timed out.");
         }
+        return std::move(syncRequest.response);
     }
 
     void MessageBusMalamute::listener(zsock_t *pipe, void *args) {
@@ -253,13 +277,19 @@ namespace messagebus {
 
     void MessageBusMalamute::listenerMainloop(zsock_t *pipe)
     {
-        zpoller_t *poller = zpoller_new (pipe, mlm_client_msgpipe (m_client), nullptr);
+        zpoller_t *poller = zpoller_new (pipe, mlm_client_msgpipe (m_client), m_doorbellListener, nullptr);
         zsock_signal (pipe, 0);
         log_trace ("%s - listener mainloop ready", m_clientName.c_str());
 
         bool stopping = false;
         while (!stopping) {
-            void *which = zpoller_wait (poller, -1);
+            // With messages waiting to be dispatched, only check for what else came in.
+            bool pending = !m_pending.empty();
+            if (m_pending.size() >= PENDING_DELIVERIES_MAX) {
+                listenerDispatchPending ();
+                continue;
+            }
+            void *which = zpoller_wait (poller, pending ? 0 : -1);
 
             if (which == pipe) {
                 zmsg_t *message = zmsg_recv (pipe);
@@ -268,6 +298,7 @@ namespace messagebus {
 
                 //  $TERM actor command implementation is required by zactor_t interface
                 if (streq (actor_command, "$TERM")) {
+                    listenerFlushOutbox ();
                     stopping = true;
                     zstr_free (&actor_command);
                 }
@@ -276,25 +307,15 @@ namespace messagebus {
                     zstr_free (&actor_command);
                 }
             }
+            else if (which == m_doorbellListener) {
+                zsock_wait (m_doorbellListener);
+                listenerFlushOutbox ();
+            }
             else if (which == mlm_client_msgpipe (m_client)) {
-                zmsg_t *message = mlm_client_recv (m_client);
-                if (message == nullptr) {
-                    stopping = true;
-                }
-                else {
-                    const char *subject = mlm_client_subject (m_client);
-                    const char *from = mlm_client_sender (m_client);
-                    const char *command = mlm_client_command (m_client);
-
-                    if (streq (command, "MAILBOX DELIVER")) {
-                        listenerHandleMailbox (subject, from, message);
-                    } else if (streq (command, "STREAM DELIVER")) {
-                        listenerHandleStream (subject, from, message);
-                    } else {
-                        log_error ("%s - unknown malamute pattern '%s' from '%s' subject '%s'", m_clientName.c_str(), command, from, subject);
-                    }
-                    zmsg_destroy (&message);
-                }
+                stopping = !listenerReceive (m_client);
+            }
+            else if (pending) {
+                listenerDispatchPending ();
             }
         }
 
@@ -303,61 +324,145 @@ namespace messagebus {
         log_debug ("%s - listener mainloop terminated", m_clientName.c_str());
     }
 
-    void MessageBusMalamute::listenerHandleMailbox (const char *subject, const char *from, zmsg_t *message)
+    void MessageBusMalamute::listenerFlushOutbox ()
     {
-        log_debug ("%s - received mailbox message from '%s' subject '%s'", m_clientName.c_str(), from, subject);
-
-        Message msg = _fromZmsg(message);
-
-        bool syncResponse = false;
-        if( m_syncUuid != "" ) {
-            auto it = msg.metaData().find(Message::CORRELATION_ID);
-            if( it != msg.metaData().end() ) {
-                if( m_syncUuid == it->second ) {
-                    std::unique_lock<std::mutex> lock(m_cv_mtx);
-                    m_syncResponse = msg;
-                    m_cv.notify_one();
-                    m_syncUuid = "";
-                    syncResponse = true;
+        // Write the whole outbox at once. This single writer replaces a pool of
+        // connections: one client written from one thread keeps every message in order.
+        Outgoing outgoing;
+
+        while (true) {
+            if (!m_outbox.pop (outgoing)) {
+                // Senders which pushed before we went idle did not ring, check once more.
+                m_outboxIdle.exchange (true);
+                if (!m_outbox.pop (outgoing)) {
+                    break;
                 }
+                m_outboxIdle.exchange (false);
             }
-        }
-        if( syncResponse == false ) {
-            auto iterator = m_subscriptions.find (subject);
-            if (iterator != m_subscriptions.end ()) {
-                try {
-                    (iterator->second)(msg);
-                }
-                catch(const std::exception& e) {
-                    log_error("Error in listener of queue '%s': '%s'", iterator->first.c_str(), e.what());
+
+            int rc;
+            if (!outgoing.content) {
+                // Refused when posted, only its completion is left.
+                rc = -1;
+            }
+            else if (outgoing.stream) {
+                std::unique_lock<std::mutex> lock(m_clientMutex);
+                // One client produces on every topic, switching stream when the topic changes.
+                rc = 0;
+                if (outgoing.address != m_publishTopic) {
+                    rc = mlm_client_set_producer (m_client, outgoing.address.c_str());
+                    if (rc != -1) {
+                        m_publishTopic = outgoing.address;
+                        log_trace ("%s - registered as stream producter on '%s'", m_clientName.c_str(), m_publishTopic.c_str());
+                    }
+                    else {
+                        // Unknown stream, switch again on next send.
+                        m_publishTopic.clear();
+                    }
                 }
-                catch(...) {
-                    log_error("Error in listener of queue '%s': 'unknown error'", iterator->first.c_str());
+                if (rc != -1) {
+                    rc = mlm_client_send (m_client, outgoing.address.c_str(), &outgoing.content);
                 }
             }
             else {
+                std::unique_lock<std::mutex> lock(m_clientMutex);
+                rc = mlm_client_sendto (m_client, outgoing.address.c_str(), outgoing.subject.c_str(), nullptr, 200, &outgoing.content);
+            }
+
+            if (rc == -1) {
+                log_error ("%s - failed to send message to '%s'", m_clientName.c_str(), outgoing.address.c_str());
+                zmsg_destroy (&outgoing.content);
+            }
+            complete (outgoing, rc != -1);
+        }
+    }
+
+    void MessageBusMalamute::complete (Outgoing& outgoing, bool sent)
+    {
+        if (outgoing.completion) {
+            try {
+                outgoing.completion (sent);
+            }
+            catch(const std::exception& e) {
+                log_error("Error in completion of message to '%s': '%s'", outgoing.address.c_str(), e.what());
+            }
+            catch(...) {
+                log_error("Error in completion of message to '%s': 'unknown error'", outgoing.address.c_str());
+            }
+            outgoing.completion = nullptr;
+        }
+    }
+
+    bool MessageBusMalamute::listenerReceive (mlm_client_t *client)
+    {
+        zmsg_t *message = mlm_client_recv (client);
+        if (message == nullptr) {
+            return false;
+        }
+
+        const char *subject = mlm_client_subject (client);
+        const char *from = mlm_client_sender (client);
+        const char *command = mlm_client_command (client);
+
+        if (streq (command, "MAILBOX DELIVER")) {
+            listenerHandleMailbox (subject, from, message);
+        } else if (streq (command, "STREAM DELIVER")) {
+            listenerHandleStream (subject, from, message);
+        } else {
+            log_error ("%s - unknown malamute pattern '%s' from '%s' subject '%s'", m_clientName.c_str(), command, from, subject);
+        }
+        zmsg_destroy (&message);
+        return true;
+    }
+
+    void MessageBusMalamute::listenerDeliver (const char *type, const char *name, Message&& message)
+    {
+        // Without priorities, dispatch right away.
+        bool prioritized = m_priorities.any();
+        if (!prioritized && m_pending.empty()) {
+            if (!m_listeners.dispatch (type, name, message) && streq (type, "queue")) {
                 log_warning("Message skipped");
             }
+            return;
         }
+
+        // Otherwise queue in the lane of its priority, dispatched once nothing else is readable.
+        m_pending.push (Delivery{type, name, std::move(message)}, prioritized && m_priorities.isHigh (name));
     }
 
-    void MessageBusMalamute::listenerHandleStream (const char *subject, const char *from, zmsg_t *message)
+    void MessageBusMalamute::listenerDispatchPending ()
     {
-        log_trace ("%s - received stream message from '%s' subject '%s'", m_clientName.c_str(), from, subject);
+        Delivery delivery;
+        m_pending.pop (delivery);
+        if (!m_listeners.dispatch (delivery.type, delivery.name, delivery.message) && streq (delivery.type, "queue")) {
+            log_warning("Message skipped");
+        }
+    }
+
+    void MessageBusMalamute::listenerHandleMailbox (const char *subject, const char *from, zmsg_t *message)
+    {
+        log_debug ("%s - received mailbox message from '%s' subject '%s'", m_clientName.c_str(), from, subject);
+
         Message msg = _fromZmsg(message);
 
-        auto iterator = m_subscriptions.find (subject);
-        if (iterator != m_subscriptions.end ()) {
-                try {
-                    (iterator->second)(msg);
-                }
-                catch(const std::exception& e) {
-                    log_error("Error in listener of topic '%s': '%s'", iterator->first.c_str(), e.what());
-                }
-                catch(...) {
-                    log_error("Error in listener of topic '%s': 'unknown error'", iterator->first.c_str());
-                }
+        auto it = msg.metaData().find(Message::CORRELATION_ID);
+        if( it != msg.metaData().end() ) {
+            std::unique_lock<std::mutex> lock(m_cv_mtx);
+            auto syncRequest = m_syncRequests.find(it->second);
+            if( syncRequest != m_syncRequests.end() && !syncRequest->second->replied ) {
+                syncRequest->second->response = std::move(msg);
+                syncRequest->second->replied = true;
+                m_cv.notify_all();
+                return;
+            }
         }
+        listenerDeliver ("queue", subject, std::move(msg));
+    }
+
+    void MessageBusMalamute::listenerHandleStream (const char *subject, const char *from, zmsg_t *message)
+    {
+        log_trace ("%s - received stream message from '%s' subject '%s'", m_clientName.c_str(), from, subject);
+        listenerDeliver ("topic", subject, _fromZmsg(message));
     }
 
 }
@@ -27,12 +27,17 @@
 #include "fty_common_messagebus_interface.h"
 #include "fty_common_messagebus_exception.h"
 #include "fty_common_messagebus_message.h"
+#include "fty_common_messagebus_bus_support.h"
+#include "fty_common_messagebus_mpsc_queue.h"
 
 #include <fty_common_mlm.h>
+#include <atomic>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
+#include <vector>
 
 namespace messagebus {
 
@@ -48,36 +53,92 @@ namespace messagebus {
         
          // Async topic
         void publish(const std::string& topic, const Message& message) override;
-        void subscribe(const std::string& topic, MessageListener messageListener) override;
+        void publish(const std::string& topic, const Message& message, SendCompletion completion) override;
+        SubscriptionHandle subscribe(const std::string& topic, MessageListener messageListener) override;
         void unsubscribe(const std::string& topic, MessageListener messageListener) override;
+        void unsubscribe(SubscriptionHandle handle) override;
 
         // Async queue
         void sendRequest(const std::string& requestQueue, const Message& message) override;
+        void sendRequest(const std::string& requestQueue, const Message& message, SendCompletion completion) override;
         void sendRequest(const std::string& requestQueue, const Message& message, MessageListener messageListener) override;
         void sendReply(const std::string& replyQueue, const Message& message) override;
-        void receive(const std::string& queue, MessageListener messageListener) override;
+        void sendReply(const std::string& replyQueue, const Message& message, SendCompletion completion) override;
+        SubscriptionHandle receive(const std::string& queue, MessageListener messageListener) override;
+
+        void setPriority(const std::string& name, Priority priority) override;
 
         // Sync queue
         Message request(const std::string& requestQueue, const Message& message, int receiveTimeOut) override;
         
       private:
+        // Message waiting in the outbox to be written by the listener thread.
+        struct Outgoing {
+            bool           stream = false;      // Stream send, or mailbox send.
+            std::string    address;             // Topic for a stream, recipient for a mailbox.
+            std::string    subject;
+            zmsg_t        *content = nullptr;
+            SendCompletion completion;
+        };
+
+        // Message received but not dispatched yet, when priorities are in use.
+        struct Delivery {
+            const char *type = nullptr;
+            std::string name;
+            Message     message;
+        };
+
+        // Number of messages read ahead of dispatching, when priorities are in use.
+        static constexpr size_t PENDING_DELIVERIES_MAX = 1024;
+
+        // Pending synchronous request, filled by the listener thread.
+        struct SyncRequest {
+            bool    replied = false;
+            Message response;
+        };
+
         static void listener(zsock_t *pipe, void* ptr);
         void listenerMainloop(zsock_t *pipe);
         void listenerHandleMailbox (const char *, const char *, zmsg_t *);
         void listenerHandleStream (const char *, const char *, zmsg_t *);
 
+        void post(Outgoing&& outgoing);
+        void complete(Outgoing& outgoing, bool sent);
+        void listenerFlushOutbox();
+        bool listenerReceive(mlm_client_t *client);
+        void listenerDeliver(const char *type, const char *name, Message&& message);
+        void listenerDispatchPending();
+
         mlm_client_t *m_client = nullptr;
         std::string   m_clientName;
         std::string   m_endpoint;
+        // Stream m_client currently produces on, switched by the listener thread before each
+        // send to another topic.
         std::string   m_publishTopic;
 
+        // Guards the commands sent to m_client (set producer or consumer, send) from
+        // several threads.
+        std::mutex    m_clientMutex;
+
+        // Outgoing messages, written by the listener thread. Senders only ring the
+        // doorbell when the listener thread may be waiting for it.
+        PriorityLanes<Outgoing, MpscQueue<Outgoing>> m_outbox;
+        std::atomic<bool>   m_outboxIdle{true};
+        std::mutex          m_doorbellMutex;
+        zsock_t            *m_doorbell = nullptr;
+        zsock_t            *m_doorbellListener = nullptr;
+
         zactor_t     *m_actor = nullptr;
-        std::map<std::string, MessageListener> m_subscriptions;
+
+        ListenerRegistry m_listeners;
+        PriorityNames    m_priorities;
+
+        // Priority lanes of received messages (listener thread only).
+        PriorityLanes<Delivery> m_pending;
 
         std::condition_variable m_cv;
         std::mutex m_cv_mtx;
-        Message m_syncResponse;
-        std::string m_syncUuid;
+        std::map<std::string, SyncRequest*> m_syncRequests;
     };
 }
 
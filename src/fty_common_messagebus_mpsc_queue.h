@@ -0,0 +1,122 @@
+/*  =========================================================================
+    fty_common_messagebus_mpsc_queue - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_COMMON_MESSAGEBUS_MPSC_QUEUE_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_MPSC_QUEUE_H_INCLUDED
+
+#include <atomic>
+#include <utility>
+
+namespace messagebus {
+
+/**
+ * \brief Unbounded lock-free multiple producers, single consumer queue.
+ *
+ * Intrusive linked list with a stub node (D. Vyukov). push() is wait-free and
+ * can be called from any thread, pop() must only be called from one thread.
+ * pop() may transiently see the queue empty while a push() is in progress, the
+ * pushing thread must then notify the consumer after pushing.
+ */
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() : m_head(&m_stub), m_tail(&m_stub) {
+        m_stub.next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    ~MpscQueue() {
+        T value;
+        while (pop(value)) {
+        }
+    }
+
+    /**
+     * \brief Push a value (any thread).
+     * \param value Value to push.
+     */
+    void push(T&& value) {
+        pushNode(new Node(std::move(value)));
+    }
+
+    /**
+     * \brief Pop a value (consumer thread only).
+     * \param value Popped value.
+     * \return false if the queue is empty.
+     */
+    bool pop(T& value) {
+        NodeBase* tail = m_tail;
+        NodeBase* next = tail->next.load(std::memory_order_acquire);
+
+        if (tail == &m_stub) {
+            if (next == nullptr) {
+                return false;
+            }
+            m_tail = next;
+            tail   = next;
+            next   = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next == nullptr) {
+            if (tail != m_head.load(std::memory_order_acquire)) {
+                // A producer is between exchanging m_head and linking its node.
+                return false;
+            }
+            pushNode(&m_stub);
+            next = tail->next.load(std::memory_order_acquire);
+            if (next == nullptr) {
+                return false;
+            }
+        }
+
+        m_tail = next;
+        Node* node = static_cast<Node*>(tail);
+        value = std::move(node->value);
+        delete node;
+        return true;
+    }
+
+private:
+    struct NodeBase {
+        std::atomic<NodeBase*> next;
+    };
+
+    struct Node : NodeBase {
+        explicit Node(T&& v) : value(std::move(v)) { }
+        T value;
+    };
+
+    void pushNode(NodeBase* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        NodeBase* previous = m_head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    std::atomic<NodeBase*> m_head;
+    NodeBase* m_tail;
+    NodeBase m_stub;
+} ;
+
+}
+
+#endif
@@ -28,32 +28,543 @@
 
 #include "fty_common_messagebus_classes.h"
 
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <set>
+#include <sstream>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 namespace messagebus {
 
-PoolWorker::PoolWorker(size_t workers) : m_terminated(false) {
-    auto workerMainloop = [this]() {
-        while (true) {
-            std::unique_lock<std::mutex> lk(m_mutex);
-            m_cv.wait(lk, [this]() -> bool { return m_terminated.load() || m_jobs.size(); });
+namespace {
+
+// Pool and index of the worker running on the current thread, if any.
+thread_local const PoolWorker* t_pool = nullptr;
+thread_local size_t t_worker = 0;
+
+constexpr size_t NO_WORKER = size_t(-1);
+
+// Urgent work done in a row before doing other work, if any.
+constexpr unsigned URGENT_BURST = 8;
+
+int64_t steadyNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// CPUs of a NUMA node, from its cpulist ("0-3,8,10-11").
+std::vector<int> numaNodeCpus(int node) {
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string   list;
+    if (!std::getline(file, list)) {
+        throw std::runtime_error("Can't read CPUs of NUMA node " + std::to_string(node));
+    }
+
+    std::vector<int>  cpus;
+    std::stringstream ranges(list);
+    std::string       range;
+    while (std::getline(ranges, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        auto dash  = range.find('-');
+        int  first = std::stoi(range.substr(0, dash));
+        int  last  = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+}
+
+/// \brief Work queued in a PoolWorker.
+struct PoolWorkerJob {
+    WorkUnit work;
+    /// When the work was queued (steady clock, in ns), 0 if statistics are compiled out.
+    int64_t queuedAt = 0;
+} ;
+
+/**
+ * \brief Work container of a PoolWorker.
+ *
+ * Never blocks on empty, the workers sleep in PoolWorker itself.
+ */
+class PoolWorkerJobQueue {
+public:
+    virtual ~PoolWorkerJobQueue() = default;
+
+    /**
+     * \brief Queue work.
+     * \param job Work to queue.
+     * \param worker Index of the calling worker, NO_WORKER if not called from a worker.
+     */
+    virtual void push(PoolWorkerJob&& job, size_t worker) = 0;
+
+    /**
+     * \brief Queue a batch of work.
+     * \param works Work to queue, moved from.
+     * \param queuedAt When the work was queued.
+     * \param worker Index of the calling worker, NO_WORKER if not called from a worker.
+     */
+    virtual void pushBatch(std::vector<WorkUnit>& works, int64_t queuedAt, size_t worker) = 0;
+
+    /**
+     * \brief Take work to do.
+     * \param job Work taken.
+     * \param worker Index of the calling worker.
+     * \return false if there is no work to do.
+     */
+    virtual bool pop(PoolWorkerJob& job, size_t worker) = 0;
+} ;
+
+/**
+ * \brief Urgent work of a PoolWorker, by virtual deadline.
+ *
+ * Checking for work when there's none doesn't lock.
+ */
+class PoolWorkerUrgentQueue {
+public:
+    PoolWorkerUrgentQueue() : m_size(0), m_sequence(0) { }
+
+    void push(PoolWorkerJob&& job, int64_t key) {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_heap.push_back(Entry{key, m_sequence++, std::move(job)});
+        std::push_heap(m_heap.begin(), m_heap.end(), Entry::later);
+        m_size.fetch_add(1);
+    }
 
-            while (!m_jobs.empty()) {
-                auto work = std::move(m_jobs.front());
-                m_jobs.pop();
-                lk.unlock();
+    bool pop(PoolWorkerJob& job) {
+        if (m_size.load() == 0) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lk(m_mutex);
+        if (m_heap.empty()) {
+            return false;
+        }
+        std::pop_heap(m_heap.begin(), m_heap.end(), Entry::later);
+        job = std::move(m_heap.back().job);
+        m_heap.pop_back();
+        m_size.fetch_sub(1);
+        return true;
+    }
+
+private:
+    struct Entry {
+        int64_t key;
+        uint64_t sequence;
+        PoolWorkerJob job;
+
+        // Heap order, the earliest virtual deadline first and then first come, first served.
+        static bool later(const Entry& a, const Entry& b) {
+            return a.key != b.key ? a.key > b.key : a.sequence > b.sequence;
+        }
+    } ;
 
-                work();
+    std::mutex m_mutex;
+    std::vector<Entry> m_heap;
+    std::atomic<size_t> m_size;
+    uint64_t m_sequence;
+} ;
 
-                lk.lock();
+/**
+ * \brief Statistics of a PoolWorker.
+ *
+ * Durations are recorded in one slot per worker (plus one for the threads running work
+ * synchronously) so that workers don't contend on the same cache lines.
+ */
+class PoolWorkerStats {
+public:
+    PoolWorkerStats(size_t workers) : m_slots(workers + 1), m_scheduled(0), m_queued(0), m_maxQueued(0) { }
+
+    void queued(size_t count) {
+        m_scheduled.fetch_add(count, std::memory_order_relaxed);
+        int64_t queued = m_queued.fetch_add(int64_t(count), std::memory_order_relaxed) + int64_t(count);
+        atomicMax(m_maxQueued, queued);
+    }
+
+    void dequeued() {
+        m_queued.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void ranSynchronously(int64_t runTime) {
+        m_scheduled.fetch_add(1, std::memory_order_relaxed);
+        ran(NO_WORKER, 0, runTime);
+    }
+
+    void ran(size_t worker, int64_t waitTime, int64_t runTime) {
+        auto& slot = m_slots[worker == NO_WORKER ? m_slots.size() - 1 : worker];
+        slot.completed.fetch_add(1, std::memory_order_relaxed);
+        slot.waitTime.record(waitTime);
+        slot.runTime.record(runTime);
+    }
+
+    void snapshot(PoolWorker::Stats& stats) const {
+        stats.enabled       = true;
+        stats.scheduled     = m_scheduled.load(std::memory_order_relaxed);
+        stats.queueDepth    = size_t(std::max<int64_t>(m_queued.load(std::memory_order_relaxed), 0));
+        stats.maxQueueDepth = size_t(m_maxQueued.load(std::memory_order_relaxed));
+        for (const auto& slot : m_slots) {
+            stats.completed += slot.completed.load(std::memory_order_relaxed);
+            slot.waitTime.addTo(stats.waitTime);
+            slot.runTime.addTo(stats.runTime);
+        }
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> completed {0};
+        AtomicHistogram waitTime;
+        AtomicHistogram runTime;
+    } ;
+
+    std::vector<Slot> m_slots;
+    std::atomic<uint64_t> m_scheduled;
+    std::atomic<int64_t> m_queued;
+    std::atomic<int64_t> m_maxQueued;
+} ;
+
+namespace {
+
+// Run queued work, recording how long it waited and ran.
+void runJob(PoolWorkerJob& job, PoolWorkerStats* stats, size_t worker) {
+#ifndef FTY_COMMON_MESSAGEBUS_NO_POOL_WORKER_STATS
+    int64_t start = steadyNow();
+    stats->dequeued();
+    job.work();
+    stats->ran(worker, start - job.queuedAt, steadyNow() - start);
+#else
+    (void)stats;
+    (void)worker;
+    job.work();
+#endif
+    job.work = nullptr;
+}
+
+// Take work to do, urgent work first but not more than URGENT_BURST times in a row.
+bool popJob(PoolWorkerJobQueue& jobs, PoolWorkerUrgentQueue& urgent, PoolWorkerJob& job, size_t worker, unsigned& urgentStreak) {
+    if (urgentStreak >= URGENT_BURST && jobs.pop(job, worker)) {
+        urgentStreak = 0;
+        return true;
+    }
+    if (urgent.pop(job)) {
+        urgentStreak++;
+        return true;
+    }
+    urgentStreak = 0;
+    return jobs.pop(job, worker);
+}
+
+// Run work in the calling thread, recording how long it ran.
+void runSynchronously(WorkUnit& work, PoolWorkerStats* stats) {
+#ifndef FTY_COMMON_MESSAGEBUS_NO_POOL_WORKER_STATS
+    int64_t start = steadyNow();
+    work();
+    stats->ranSynchronously(steadyNow() - start);
+#else
+    (void)stats;
+    work();
+#endif
+}
+
+// When work is queued, for the statistics.
+int64_t queueTime(PoolWorkerStats* stats, size_t count) {
+#ifndef FTY_COMMON_MESSAGEBUS_NO_POOL_WORKER_STATS
+    stats->queued(count);
+    return steadyNow();
+#else
+    (void)stats;
+    (void)count;
+    return 0;
+#endif
+}
+
+/// \brief One queue shared by all the workers.
+class SharedJobQueue : public PoolWorkerJobQueue {
+public:
+    void push(PoolWorkerJob&& job, size_t /*worker*/) override {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+
+    void pushBatch(std::vector<WorkUnit>& works, int64_t queuedAt, size_t /*worker*/) override {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        for (auto& work : works) {
+            m_jobs.push_back(PoolWorkerJob{std::move(work), queuedAt});
+        }
+    }
+
+    bool pop(PoolWorkerJob& job, size_t /*worker*/) override {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        if (m_jobs.empty()) {
+            return false;
+        }
+        job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::deque<PoolWorkerJob> m_jobs;
+} ;
+
+/**
+ * \brief One queue per worker, with work stealing.
+ *
+ * Workers push to and pop from the back of their own queue (LIFO, the newest job
+ * is still hot in the cache), work from other threads is spread round-robin. An
+ * idle worker steals the oldest job from the front of the queue of the others,
+ * starting with a random one so that thieves don't all contend on the same victim.
+ */
+class StealingJobQueue : public PoolWorkerJobQueue {
+public:
+    StealingJobQueue(size_t workers) : m_queues(workers), m_next(0) { }
+
+    void push(PoolWorkerJob&& job, size_t worker) override {
+        if (worker == NO_WORKER) {
+            worker = m_next.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+        }
+
+        auto& queue = m_queues[worker];
+        std::unique_lock<std::mutex> lk(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+
+    void pushBatch(std::vector<WorkUnit>& works, int64_t queuedAt, size_t /*worker*/) override {
+        // Spread the batch evenly, locking each queue once.
+        size_t first = m_next.fetch_add(1, std::memory_order_relaxed);
+        for (size_t cpt = 0; cpt < m_queues.size() && cpt < works.size(); cpt++) {
+            auto& queue = m_queues[(first + cpt) % m_queues.size()];
+            std::unique_lock<std::mutex> lk(queue.mutex);
+            for (size_t index = cpt; index < works.size(); index += m_queues.size()) {
+                queue.jobs.push_back(PoolWorkerJob{std::move(works[index]), queuedAt});
             }
+        }
+    }
 
-            if (m_terminated.load()) {
-                break;
+    bool pop(PoolWorkerJob& job, size_t worker) override {
+        {
+            auto& queue = m_queues[worker];
+            std::unique_lock<std::mutex> lk(queue.mutex);
+            if (!queue.jobs.empty()) {
+                job = std::move(queue.jobs.back());
+                queue.jobs.pop_back();
+                return true;
+            }
+        }
+
+        thread_local std::minstd_rand random(std::random_device{}());
+        size_t first = random() % m_queues.size();
+        for (size_t cpt = 0; cpt < m_queues.size(); cpt++) {
+            size_t victim = (first + cpt) % m_queues.size();
+            if (victim == worker) {
+                continue;
             }
+
+            auto& queue = m_queues[victim];
+            std::unique_lock<std::mutex> lk(queue.mutex);
+            if (!queue.jobs.empty()) {
+                job = std::move(queue.jobs.front());
+                queue.jobs.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    // Keep each queue on its own cache line.
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<PoolWorkerJob> jobs;
+    } ;
+
+    std::vector<Queue> m_queues;
+    std::atomic<size_t> m_next;
+} ;
+
+/**
+ * \brief Bounded lock-free ring shared by all the workers (D. Vyukov).
+ *
+ * Each cell has a sequence number telling whether it is free for the push at this
+ * position or filled for the pop at this position, producers and consumers only
+ * contend on their own index. When the ring is full, work overflows into a queue
+ * under lock, which may reorder it with the work in the ring.
+ */
+class RingJobQueue : public PoolWorkerJobQueue {
+public:
+    RingJobQueue(size_t capacity) : m_pushIndex(0), m_popIndex(0), m_overflowSize(0) {
+        size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        m_mask = size - 1;
+        m_cells.reset(new Cell[size]);
+        for (size_t index = 0; index < size; index++) {
+            m_cells[index].sequence.store(index, std::memory_order_relaxed);
+        }
+    }
+
+    void push(PoolWorkerJob&& job, size_t /*worker*/) override {
+        if (!tryPush(job)) {
+            std::unique_lock<std::mutex> lk(m_overflowMutex);
+            m_overflow.push_back(std::move(job));
+            m_overflowSize.fetch_add(1);
+        }
+    }
+
+    void pushBatch(std::vector<WorkUnit>& works, int64_t queuedAt, size_t worker) override {
+        for (auto& work : works) {
+            push(PoolWorkerJob{std::move(work), queuedAt}, worker);
+        }
+    }
+
+    bool pop(PoolWorkerJob& job, size_t /*worker*/) override {
+        if (tryPop(job)) {
+            return true;
+        }
+        if (m_overflowSize.load() == 0) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lk(m_overflowMutex);
+        if (m_overflow.empty()) {
+            return false;
         }
+        job = std::move(m_overflow.front());
+        m_overflow.pop_front();
+        m_overflowSize.fetch_sub(1);
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        PoolWorkerJob job;
     } ;
 
-    for (size_t cpt = 0; cpt < workers; cpt++) {
-        m_workers.emplace_back(std::thread(workerMainloop));
+    bool tryPush(PoolWorkerJob& job) {
+        Cell*  cell;
+        size_t position = m_pushIndex.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[position & m_mask];
+            auto difference = intptr_t(cell->sequence.load(std::memory_order_acquire)) - intptr_t(position);
+            if (difference == 0) {
+                if (m_pushIndex.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (difference < 0) {
+                // Full.
+                return false;
+            }
+            else {
+                position = m_pushIndex.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->job = std::move(job);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(PoolWorkerJob& job) {
+        Cell*  cell;
+        size_t position = m_popIndex.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[position & m_mask];
+            auto difference = intptr_t(cell->sequence.load(std::memory_order_acquire)) - intptr_t(position + 1);
+            if (difference == 0) {
+                if (m_popIndex.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (difference < 0) {
+                // Empty.
+                return false;
+            }
+            else {
+                position = m_popIndex.load(std::memory_order_relaxed);
+            }
+        }
+
+        job = std::move(cell->job);
+        cell->sequence.store(position + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_pushIndex;
+    alignas(64) std::atomic<size_t> m_popIndex;
+
+    std::mutex m_overflowMutex;
+    std::deque<PoolWorkerJob> m_overflow;
+    std::atomic<size_t> m_overflowSize;
+} ;
+
+}
+
+PoolWorker::PoolWorker(size_t workers, Scheduler scheduler) : PoolWorker([&]() {
+        Options options;
+        options.workers   = workers;
+        options.scheduler = scheduler;
+        return options;
+    }()) {
+}
+
+PoolWorker::PoolWorker(const Options& options)
+    : m_options(options)
+    , m_terminated(false)
+    , m_live(0)
+    , m_idle(new EventCount())
+    , m_backlogSince(0) {
+    m_options.maxWorkers = std::max(m_options.workers, m_options.maxWorkers);
+
+    if (m_options.numaNode >= 0) {
+        std::set<int> cpus(m_options.cpus.begin(), m_options.cpus.end());
+        for (int cpu : numaNodeCpus(m_options.numaNode)) {
+            cpus.insert(cpu);
+        }
+        m_options.cpus.assign(cpus.begin(), cpus.end());
+    }
+
+    if (m_options.scheduler == Scheduler::WorkStealing && m_options.maxWorkers) {
+        m_jobs.reset(new StealingJobQueue(m_options.maxWorkers));
+    }
+    else if (m_options.scheduler == Scheduler::LockFreeRing) {
+        m_jobs.reset(new RingJobQueue(m_options.ringCapacity));
+    }
+    else {
+        m_jobs.reset(new SharedJobQueue());
+    }
+    m_urgent.reset(new PoolWorkerUrgentQueue());
+
+#ifndef FTY_COMMON_MESSAGEBUS_NO_POOL_WORKER_STATS
+    m_stats.reset(new PoolWorkerStats(m_options.maxWorkers));
+#endif
+
+    m_workers.resize(m_options.maxWorkers);
+    m_running.resize(m_options.maxWorkers, false);
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+    for (size_t cpt = 0; cpt < m_options.workers; cpt++) {
+        spawnWorker();
+    }
+    if (m_options.maxWorkers > m_options.workers) {
+        m_supervisor = std::thread(&PoolWorker::superviseWorkers, this);
     }
 }
 
@@ -62,29 +573,387 @@ PoolWorker::~PoolWorker() {
         {
             std::unique_lock<std::mutex> lk(m_mutex);
             m_terminated.store(true);
-            m_cv.notify_all();
+        }
+        m_idle->notifyAll();
+        m_supervise.notify_all();
+        if (m_supervisor.joinable()) {
+            m_supervisor.join();
         }
 
         for (auto& th : m_workers) {
-            th.join();
+            if (th.joinable()) {
+                th.join();
+            }
         }
     }
 }
 
-void PoolWorker::scheduleWork(WorkUnit&& work) {
+size_t PoolWorker::workerCount() const {
+    return m_live.load();
+}
+
+PoolWorker::Stats PoolWorker::stats() const {
+    Stats stats;
+    stats.workers     = m_live.load();
+    stats.idleWorkers = m_idle->waiters();
+    if (m_stats) {
+        m_stats->snapshot(stats);
+    }
+    return stats;
+}
+
+std::chrono::nanoseconds PoolWorker::Histogram::percentile(double percent) const {
+    if (!count) {
+        return std::chrono::nanoseconds(0);
+    }
+
+    auto rank = uint64_t(std::ceil(double(count) * std::min(std::max(percent, 0.), 100.) / 100.));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKETS - 1; bucket++) {
+        seen += buckets[bucket];
+        if (seen >= std::max<uint64_t>(rank, 1)) {
+            return std::min(max, std::chrono::nanoseconds(std::chrono::microseconds(uint64_t(1) << bucket)));
+        }
+    }
+    return max;
+}
+
+void PoolWorker::spawnWorker() {
+    // Called with m_mutex held, reuse the slot of a worker which exited.
+    auto slot = std::find(m_running.begin(), m_running.end(), false);
+    if (slot == m_running.end()) {
+        return;
+    }
+
+    size_t index = size_t(slot - m_running.begin());
+    if (m_workers[index].joinable()) {
+        m_workers[index].join();
+    }
+    m_workers[index] = std::thread(&PoolWorker::workerMainloop, this, index);
+    m_running[index] = true;
+    m_live.fetch_add(1);
+}
+
+void PoolWorker::growWorkers() {
+    size_t live = m_live.load();
+    if (live >= m_options.maxWorkers) {
+        return;
+    }
+
+    // Without any worker, work can't wait. Otherwise, grow once work waited for too long.
+    int64_t now = steadyNow();
+    if (live) {
+        int64_t since = m_backlogSince.load();
+        if (!since || now - since < std::chrono::duration_cast<std::chrono::nanoseconds>(m_options.growthLatency).count()) {
+            return;
+        }
+    }
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+    live = m_live.load();
+    if (m_terminated.load() || live >= m_options.maxWorkers || (live && m_idle->waiters())) {
+        return;
+    }
+
+    try {
+        spawnWorker();
+    }
+    catch (std::exception& e) {
+        log_warning("Failed to spawn worker: %s", e.what());
+    }
+    // Give the new worker a chance to absorb the backlog before growing again.
+    m_backlogSince.store(now);
+}
+
+void PoolWorker::superviseWorkers() {
+    // Work only makes the pool grow when it is queued or when a job ends, check
+    // the backlog on time too so that it grows while all the workers are busy
+    // with long jobs.
+    const auto latency = std::max(m_options.growthLatency, std::chrono::milliseconds(1));
+
     std::unique_lock<std::mutex> lk(m_mutex);
+    while (!m_terminated.load()) {
+        if (!m_backlogSince.load()) {
+            m_supervise.wait(lk);
+        }
+        else if (m_live.load() >= m_options.maxWorkers) {
+            // Woken up when a worker exits.
+            m_supervise.wait(lk);
+        }
+        else {
+            m_supervise.wait_for(lk, latency);
+            lk.unlock();
+            growWorkers();
+            lk.lock();
+        }
+    }
+}
+
+void PoolWorker::notifyWorkers(bool all) {
+    if (all) {
+        m_idle->notifyAll();
+    }
+    else {
+        m_idle->notifyOne();
+    }
+
+    if (m_options.maxWorkers > m_options.workers) {
+        if (!m_idle->waiters()) {
+            // No idle worker, work is queued from now on.
+            int64_t none = 0;
+            if (m_backlogSince.compare_exchange_strong(none, steadyNow())) {
+                // Lock so that the supervisor either sees the backlog or is already waiting.
+                { std::unique_lock<std::mutex> lk(m_mutex); }
+                m_supervise.notify_one();
+            }
+        }
+        // Also spawns a worker if the last one just exited.
+        growWorkers();
+    }
+}
+
+void PoolWorker::configureWorker(size_t index) {
+    if (!m_options.name.empty()) {
+        // Thread names are limited to 15 characters, keep the index.
+        std::string suffix = "-" + std::to_string(index);
+        std::string name   = m_options.name.substr(0, 15 - std::min<size_t>(suffix.size(), 15)) + suffix;
+        if (pthread_setname_np(pthread_self(), name.c_str()) != 0) {
+            log_warning("Failed to set name of worker '%s'", name.c_str());
+        }
+    }
+
+    if (!m_options.cpus.empty()) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (int cpu : m_options.cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &cpuSet);
+            }
+        }
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0) {
+            log_warning("Failed to set CPU affinity of worker %zu", index);
+        }
+    }
+
+    if (m_options.realtimePriority > 0) {
+        sched_param param {};
+        param.sched_priority = m_options.realtimePriority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            log_warning("Failed to set real-time priority %d of worker %zu", m_options.realtimePriority, index);
+        }
+    }
+    else if (m_options.niceness != 0) {
+        // On Linux, the nice value is per thread.
+        if (setpriority(PRIO_PROCESS, id_t(syscall(SYS_gettid)), m_options.niceness) != 0) {
+            log_warning("Failed to set nice value %d of worker %zu", m_options.niceness, index);
+        }
+    }
+}
+
+void PoolWorker::workerMainloop(size_t index) {
+    t_pool   = this;
+    t_worker = index;
+    configureWorker(index);
+
+    const bool elastic = m_options.maxWorkers > m_options.workers;
+
+    PoolWorkerJob job;
+    unsigned urgentStreak = 0;
+    auto pop = [&]() { return popJob(*m_jobs, *m_urgent, job, index, urgentStreak); };
+
+    while (true) {
+        if (pop()) {
+            runJob(job, m_stats.get(), index);
+            if (elastic && m_backlogSince.load(std::memory_order_relaxed)) {
+                growWorkers();
+            }
+            continue;
+        }
+
+        if (elastic) {
+            // Found nothing to do, there's no backlog.
+            m_backlogSince.store(0, std::memory_order_relaxed);
+        }
+
+        // Announce we're going to sleep before checking a last time, so that
+        // whoever pushes work from now on knows it has to wake us up.
+        uint32_t key = m_idle->prepareWait();
+        if (pop()) {
+            m_idle->cancelWait();
+            runJob(job, m_stats.get(), index);
+            continue;
+        }
+
+        // Only terminate once there is no work left.
+        if (m_terminated.load()) {
+            m_idle->cancelWait();
+            break;
+        }
+
+        if (m_live.load() <= m_options.workers) {
+            m_idle->wait(key);
+            continue;
+        }
+
+        // Extra worker, exit once idle for long enough.
+        if (m_idle->waitFor(key, m_options.idleTimeout)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lk(m_mutex);
+        if (m_terminated.load() || m_live.load() <= m_options.workers) {
+            continue;
+        }
+
+        // Whoever pushed work without seeing this worker gone must see it here.
+        m_live.fetch_sub(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!pop()) {
+            m_running[index] = false;
+            m_supervise.notify_one();
+            break;
+        }
+        m_live.fetch_add(1);
+        lk.unlock();
+        runJob(job, m_stats.get(), index);
+    }
+}
+
+void PoolWorker::scheduleWork(WorkUnit&& work) {
     if (m_terminated.load()) {
         throw std::runtime_error("PoolThread is terminated");
     }
 
     if (m_workers.empty()) {
-        // No workers, run job synchronously.
-        work();
+        // No workers, run job synchronously (without lock, the job may schedule work as well).
+        runSynchronously(work, m_stats.get());
     }
     else {
         // Got workers, schedule.
-        m_jobs.emplace(work);
-        m_cv.notify_one();
+        m_jobs->push(PoolWorkerJob{std::move(work), queueTime(m_stats.get(), 1)}, t_pool == this ? t_worker : NO_WORKER);
+        notifyWorkers(false);
+    }
+}
+
+void PoolWorker::scheduleUrgentWork(const Urgency& urgency, WorkUnit&& work) {
+    if (m_terminated.load()) {
+        throw std::runtime_error("PoolThread is terminated");
+    }
+
+    if (m_workers.empty()) {
+        // No workers, run job synchronously.
+        runSynchronously(work, m_stats.get());
+        return;
+    }
+
+    // Virtual deadline, the priority boost is saturated to stay away from overflows.
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    const int64_t aging    = duration_cast<nanoseconds>(m_options.priorityAging).count();
+    const int64_t bound    = std::numeric_limits<int64_t>::max() / 4;
+    const int64_t priority = urgency.priority;
+    int64_t       boost    = priority * aging;
+    if (aging > 0 && (priority > bound / aging || priority < -bound / aging)) {
+        boost = priority > 0 ? bound : -bound;
+    }
+
+    int64_t key = steadyNow() - boost;
+    if (urgency.deadline != Urgency::Clock::time_point::max()) {
+        key = std::min(key, int64_t(duration_cast<nanoseconds>(urgency.deadline.time_since_epoch()).count()));
+    }
+
+    m_urgent->push(PoolWorkerJob{std::move(work), queueTime(m_stats.get(), 1)}, key);
+    notifyWorkers(false);
+}
+
+void PoolWorker::offloadBatch(std::vector<WorkUnit>&& works) {
+    if (m_terminated.load()) {
+        throw std::runtime_error("PoolThread is terminated");
+    }
+
+    if (m_workers.empty()) {
+        // No workers, run jobs synchronously.
+        for (auto& work : works) {
+            runSynchronously(work, m_stats.get());
+        }
+    }
+    else if (!works.empty()) {
+        // Got workers, schedule everything then wake up as many as needed at once.
+        m_jobs->pushBatch(works, queueTime(m_stats.get(), works.size()), t_pool == this ? t_worker : NO_WORKER);
+        notifyWorkers(works.size() > 1);
+    }
+}
+
+size_t PoolWorker::chunkCount(size_t count, size_t grainSize) const {
+    if (grainSize) {
+        return count / grainSize + (count % grainSize != 0);
+    }
+    // A few chunks per thread, so that uneven chunks still balance out.
+    return std::min(count, (m_workers.size() + 1) * 4);
+}
+
+void PoolWorker::runChunks(size_t chunks, std::function<void(size_t)> runChunk) {
+    if (m_workers.empty() || chunks == 1) {
+        for (size_t chunk = 0; chunk < chunks; chunk++) {
+            runChunk(chunk);
+        }
+        return;
+    }
+
+    // Shared with the helpers, some of them may only start once we returned and then find no chunk left.
+    struct State {
+        std::function<void(size_t)> runChunk;
+        size_t                      chunks;
+        std::atomic<size_t>         next;
+        std::atomic<size_t>         done;
+        std::atomic_bool            failed;
+        std::exception_ptr          error;
+        std::mutex                  mutex;
+        std::condition_variable     cv;
+    } ;
+    auto state = std::make_shared<State>();
+    state->runChunk = std::move(runChunk);
+    state->chunks   = chunks;
+    state->next     = 0;
+    state->done     = 0;
+    state->failed   = false;
+
+    auto runChunks = [](State& st) {
+        for (size_t chunk = st.next.fetch_add(1); chunk < st.chunks; chunk = st.next.fetch_add(1)) {
+            // After a failure, remaining chunks are skipped.
+            if (!st.failed.load()) {
+                try {
+                    st.runChunk(chunk);
+                }
+                catch (...) {
+                    std::unique_lock<std::mutex> lk(st.mutex);
+                    if (!st.error) {
+                        st.error = std::current_exception();
+                    }
+                    st.failed = true;
+                }
+            }
+            if (st.done.fetch_add(1) + 1 == st.chunks) {
+                std::unique_lock<std::mutex> lk(st.mutex);
+                st.cv.notify_all();
+            }
+        }
+    };
+
+    std::vector<WorkUnit> helpers;
+    helpers.reserve(std::min(m_workers.size(), chunks - 1));
+    for (size_t cpt = 0; cpt < std::min(m_workers.size(), chunks - 1); cpt++) {
+        helpers.emplace_back([state, runChunks]() { runChunks(*state); });
+    }
+    offloadBatch(std::move(helpers));
+
+    // Work as well instead of blocking, then wait for the chunks taken by the helpers.
+    runChunks(*state);
+
+    std::unique_lock<std::mutex> lk(state->mutex);
+    state->cv.wait(lk, [&state]() { return state->done.load() == state->chunks; });
+    if (state->error) {
+        std::rethrow_exception(state->error);
     }
 }
 
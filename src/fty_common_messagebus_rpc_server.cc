@@ -0,0 +1,140 @@
+/*  =========================================================================
+    fty_common_messagebus_rpc_server - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_messagebus_rpc_server -
+@discuss
+@end
+*/
+
+#include "fty_common_messagebus_classes.h"
+
+namespace messagebus {
+
+/**
+ * \brief State of an RpcServer, shared with the requests scheduled on the pool.
+ */
+class RpcServerState : public std::enable_shared_from_this<RpcServerState> {
+public:
+    RpcServerState(MessageBus& bus, const std::string& queue, RpcServer::Handlers&& handlers, PoolWorker* pool) :
+        m_bus(bus),
+        m_queue(queue),
+        m_handlers(std::move(handlers)),
+        m_pool(pool) {
+    }
+
+    void receive(const Message& request) {
+        if (m_pool) {
+            auto self = shared_from_this();
+            try {
+                m_pool->offload([self, request]() { self->handle(request); });
+                return;
+            }
+            catch (std::exception&) {
+                // The pool is terminating, don't leave the request unanswered.
+            }
+        }
+        handle(request);
+    }
+
+    void handle(const Message& request) {
+        const MetaData& metaData = request.metaData();
+        auto subject = metaData.find(Message::SUBJECT);
+        const std::string& subjectName = subject != metaData.end() ? subject->second : EMPTY;
+
+        Message reply;
+        try {
+            if (!m_handlers.canDispatch(subjectName)) {
+                throw std::invalid_argument("Unknown subject '" + subjectName + "'");
+            }
+            reply.userData() = m_handlers(subjectName, request);
+            reply.metaData().emplace(Message::STATUS, STATUS_OK);
+        }
+        catch (std::exception& e) {
+            reply.userData() = { e.what() };
+            reply.metaData().emplace(Message::STATUS, STATUS_KO);
+        }
+        catch (...) {
+            reply.userData() = { "Unknown error" };
+            reply.metaData().emplace(Message::STATUS, STATUS_KO);
+        }
+
+        auto replyTo = metaData.find(Message::REPLY_TO);
+        if (replyTo == metaData.end()) {
+            if (reply.isOnError()) {
+                log_warning("%s - request '%s' failed without reply: %s", m_queue.c_str(), subjectName.c_str(), reply.userData().front().c_str());
+            }
+            return;
+        }
+        auto from = metaData.find(Message::FROM);
+        if (from == metaData.end() || from->second.empty()) {
+            log_warning("%s - request '%s' without sender, not replied", m_queue.c_str(), subjectName.c_str());
+            return;
+        }
+
+        reply.metaData().emplace(Message::SUBJECT, subjectName);
+        reply.metaData().emplace(Message::TO, from->second);
+        auto correlationId = metaData.find(Message::CORRELATION_ID);
+        if (correlationId != metaData.end()) {
+            reply.metaData().emplace(Message::CORRELATION_ID, correlationId->second);
+        }
+
+        try {
+            m_bus.sendReply(replyTo->second, reply);
+        }
+        catch (std::exception& e) {
+            log_error("%s - failed to reply to '%s': %s", m_queue.c_str(), replyTo->second.c_str(), e.what());
+        }
+    }
+
+private:
+    static const std::string EMPTY;
+
+    MessageBus& m_bus;
+    std::string m_queue;
+    RpcServer::Handlers m_handlers;
+    PoolWorker* m_pool;
+} ;
+
+const std::string RpcServerState::EMPTY;
+
+RpcServer::RpcServer(MessageBus& bus, const std::string& queue, Handlers handlers, PoolWorker* pool) :
+    m_state(std::make_shared<RpcServerState>(bus, queue, std::move(handlers), pool)),
+    m_bus(bus) {
+    auto state = m_state;
+    m_handle = m_bus.receive(queue, [state](const Message& request) { state->receive(request); });
+}
+
+RpcServer::~RpcServer() {
+    try {
+        m_bus.unsubscribe(m_handle);
+    }
+    catch (std::exception& e) {
+        log_error("Failed to stop RpcServer: %s", e.what());
+    }
+}
+
+void RpcServer::handle(const Message& request) {
+    m_state->handle(request);
+}
+
+}
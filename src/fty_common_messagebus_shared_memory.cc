@@ -0,0 +1,1079 @@
+/*  =========================================================================
+    fty_common_messagebus_shared_memory - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_messagebus_shared_memory -
+@discuss
+@end
+*/
+
+#include "fty_common_messagebus_classes.h"
+
+#ifndef FTY_COMMON_MESSAGEBUS_NO_SHARED_MEMORY
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace messagebus {
+
+namespace {
+
+// First word of a segment, once initialized by its creator.
+constexpr uint32_t SEGMENT_READY = 0x4d425348;
+// How long to wait for another process to initialize a segment.
+constexpr auto SEGMENT_READY_TIMEOUT = std::chrono::seconds(1);
+
+constexpr uint32_t MAX_CLIENTS = 256;
+constexpr uint32_t NO_DOORBELL = UINT32_MAX;
+// Owner of a mailbox closed, from then on until it is unlinked.
+constexpr uint32_t CLOSED_MAILBOX = UINT32_MAX - 1;
+
+// How long a writer waits for room in the mailbox of a connected client.
+constexpr auto MAILBOX_FULL_TIMEOUT = std::chrono::seconds(1);
+// Upper bound of a sleep, in case a wake up was lost with a process crashing.
+constexpr auto RECEIVER_SLEEP_MAX = std::chrono::seconds(1);
+
+// Records are 8 bytes aligned, and start with their kind and payload size.
+constexpr uint32_t RECORD_MESSAGE = 1;
+constexpr uint32_t RECORD_WRAP = 2;
+constexpr uint64_t RECORD_HEADER = 8;
+
+uint64_t recordSize(uint64_t payload) {
+    return (RECORD_HEADER + payload + 7) & ~uint64_t(7);
+}
+
+// Futexes are shared between processes, the FUTEX_*_PRIVATE operations can't be used.
+void futexWait(std::atomic<uint32_t>& word, uint32_t value, std::chrono::nanoseconds timeout) {
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bits");
+    timespec ts;
+    ts.tv_sec  = time_t(timeout.count() / 1000000000);
+    ts.tv_nsec = long(timeout.count() % 1000000000);
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, value, &ts, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t>& word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+bool processAlive(int32_t pid) {
+    return pid == getpid() || kill(pid, 0) == 0 || errno == EPERM;
+}
+
+// Name of a segment, characters not allowed in file names are replaced.
+std::string segmentName(const std::string& endpoint, const char *kind, const std::string& name) {
+    std::string segment = "/fty-messagebus-";
+    for (char c : endpoint + "-" + kind + "-" + name) {
+        segment += (std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_' || c == '.') ? c : '_';
+    }
+    return segment;
+}
+
+/**
+ * \brief Shared memory segment, mapped for the lifetime of the object.
+ *
+ * The process creating the segment initializes it, then publishes SEGMENT_READY in its
+ * first word. The other ones wait for it before using the segment. Without an initialize
+ * function, the segment is only opened if it exists, data() is nullptr otherwise.
+ */
+class ShmSegment {
+public:
+    ShmSegment(const std::string& name, size_t size, const std::function<void(void*)>& initialize) {
+        int fd = initialize ? shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0660) : -1;
+        bool creator = fd >= 0;
+        if (!creator) {
+            if ((initialize && errno != EEXIST) || (fd = shm_open(name.c_str(), O_RDWR, 0)) < 0) {
+                if (!initialize && errno == ENOENT) {
+                    m_data = nullptr;
+                    m_size = 0;
+                    return;
+                }
+                throw MessageBusException("Failed to open shared memory segment " + name + ": " + strerror(errno));
+            }
+        }
+        else if (ftruncate(fd, off_t(size)) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            throw MessageBusException("Failed to size shared memory segment " + name + ": " + strerror(errno));
+        }
+
+        // An existing segment keeps its size, wait for its creator to set it.
+        auto deadline = std::chrono::steady_clock::now() + SEGMENT_READY_TIMEOUT;
+        struct stat st;
+        while (fstat(fd, &st) == 0 && st.st_size == 0 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        m_size = size_t(st.st_size);
+        m_data = m_size ? mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (m_data == MAP_FAILED) {
+            throw MessageBusException("Failed to map shared memory segment " + name);
+        }
+
+        auto& ready = *static_cast<std::atomic<uint32_t>*>(m_data);
+        if (creator) {
+            initialize(m_data);
+            ready.store(SEGMENT_READY, std::memory_order_release);
+        }
+        while (ready.load(std::memory_order_acquire) != SEGMENT_READY) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                munmap(m_data, m_size);
+                throw MessageBusException("Shared memory segment " + name + " was not initialized");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    ~ShmSegment() {
+        if (m_data) {
+            munmap(m_data, m_size);
+        }
+    }
+
+    ShmSegment(const ShmSegment&) = delete;
+    ShmSegment& operator=(const ShmSegment&) = delete;
+
+    void* data() const {
+        return m_data;
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+
+private:
+    void*  m_data;
+    size_t m_size;
+} ;
+
+void initializeSharedMutex(pthread_mutex_t *mutex) {
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(mutex, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+// Lock of a process-shared mutex, recovered if its owner died.
+class SharedLock {
+public:
+    explicit SharedLock(pthread_mutex_t *mutex) : m_mutex(mutex) {
+        int rc = pthread_mutex_lock(m_mutex);
+        if (rc == EOWNERDEAD) {
+            // The writer died before committing, what it wrote is ignored.
+            pthread_mutex_consistent(m_mutex);
+        }
+        else if (rc != 0) {
+            throw MessageBusException(std::string("Failed to lock shared memory ring: ") + strerror(rc));
+        }
+    }
+
+    ~SharedLock() {
+        pthread_mutex_unlock(m_mutex);
+    }
+
+private:
+    pthread_mutex_t *m_mutex;
+} ;
+
+void putU32(char *&out, uint32_t value) {
+    memcpy(out, &value, sizeof(value));
+    out += sizeof(value);
+}
+
+void putString(char *&out, const std::string& value) {
+    putU32(out, uint32_t(value.size()));
+    memcpy(out, value.data(), value.size());
+    out += value.size();
+}
+
+bool getU32(const char *&in, const char *end, uint32_t& value) {
+    if (size_t(end - in) < sizeof(value)) {
+        return false;
+    }
+    memcpy(&value, in, sizeof(value));
+    in += sizeof(value);
+    return true;
+}
+
+bool getString(const char *&in, const char *end, std::string& value) {
+    uint32_t size;
+    if (!getU32(in, end, size) || size_t(end - in) < size) {
+        return false;
+    }
+    value.assign(in, size);
+    in += size;
+    return true;
+}
+
+// Encoding of a message: subject, then metadata pairs and user data frames, all length-prefixed.
+size_t encodedSize(const std::string& subject, const Message& message) {
+    size_t size = 4 + subject.size() + 4 + 4;
+    for (const auto& pair : message.metaData()) {
+        size += 8 + pair.first.size() + pair.second.size();
+    }
+    for (const auto& item : message.userData()) {
+        size += 4 + item.size();
+    }
+    return size;
+}
+
+void encode(char *out, const std::string& subject, const Message& message) {
+    putString(out, subject);
+    putU32(out, uint32_t(message.metaData().size()));
+    for (const auto& pair : message.metaData()) {
+        putString(out, pair.first);
+        putString(out, pair.second);
+    }
+    putU32(out, uint32_t(message.userData().size()));
+    for (const auto& item : message.userData()) {
+        putString(out, item);
+    }
+}
+
+// Bounds checked, a record overwritten while being read decodes to garbage, not out of it.
+bool decode(const char *in, size_t size, std::string& subject, Message& message) {
+    const char *end = in + size;
+    uint32_t count;
+    if (!getString(in, end, subject) || !getU32(in, end, count)) {
+        return false;
+    }
+    std::string key, value;
+    for (uint32_t cpt = 0; cpt < count; cpt++) {
+        if (!getString(in, end, key) || !getString(in, end, value)) {
+            return false;
+        }
+        message.metaData()[key] = value;
+    }
+    if (!getU32(in, end, count)) {
+        return false;
+    }
+    for (uint32_t cpt = 0; cpt < count; cpt++) {
+        if (!getString(in, end, value)) {
+            return false;
+        }
+        message.userData().push_back(std::move(value));
+    }
+    return true;
+}
+
+}
+
+/**
+ * \brief Doorbells of the clients of an endpoint, one futex each.
+ *
+ * A client sleeping on its doorbell announces it, so that writers only make the
+ * wake up system call when it's needed.
+ */
+class ShmDoorbells {
+public:
+    explicit ShmDoorbells(const std::string& endpoint)
+        : m_segment(segmentName(endpoint, "doorbells", ""), sizeof(Layout), [](void *data) { new (data) Layout(); }),
+          m_layout(static_cast<Layout*>(m_segment.data())) {
+    }
+
+    /// \brief Claim a free doorbell, or one of a dead process.
+    uint32_t claim() {
+        int32_t self = getpid();
+        for (bool reclaim : { false, true }) {
+            for (uint32_t id = 0; id < MAX_CLIENTS; id++) {
+                int32_t pid = m_layout->slots[id].pid.load();
+                if ((pid == 0 || (reclaim && !processAlive(pid))) && m_layout->slots[id].pid.compare_exchange_strong(pid, self)) {
+                    return id;
+                }
+            }
+        }
+        throw MessageBusException("Too many shared memory message bus clients.");
+    }
+
+    void release(uint32_t id) {
+        m_layout->slots[id].pid.store(0);
+    }
+
+    bool alive(uint32_t id) const {
+        int32_t pid = m_layout->slots[id].pid.load();
+        return pid != 0 && processAlive(pid);
+    }
+
+    void ring(uint32_t id) {
+        auto& slot = m_layout->slots[id];
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (slot.waiters.load()) {
+            slot.word.fetch_add(1);
+            futexWake(slot.word);
+        }
+    }
+
+    /// \brief Announce a wait, before checking for work a last time.
+    uint32_t prepareWait(uint32_t id) {
+        auto& slot = m_layout->slots[id];
+        slot.waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return slot.word.load();
+    }
+
+    void cancelWait(uint32_t id) {
+        m_layout->slots[id].waiters.fetch_sub(1);
+    }
+
+    void wait(uint32_t id, uint32_t key, std::chrono::nanoseconds timeout) {
+        auto& slot = m_layout->slots[id];
+        if (slot.word.load() == key) {
+            futexWait(slot.word, key, timeout);
+        }
+        slot.waiters.fetch_sub(1);
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> word{0};
+        std::atomic<uint32_t> waiters{0};
+        std::atomic<int32_t>  pid{0};
+    } ;
+
+    struct Layout {
+        std::atomic<uint32_t> ready{0};
+        Slot slots[MAX_CLIENTS];
+    } ;
+
+    ShmSegment m_segment;
+    Layout    *m_layout;
+} ;
+
+/**
+ * \brief Ring of messages in shared memory.
+ *
+ * Writers append records under a process-shared mutex, then publish the new write
+ * position. A mailbox has one reader, which publishes its read position so that
+ * writers don't overwrite what it hasn't read. A topic has any number of readers,
+ * each keeping its position; writers overwrite the oldest records, and readers
+ * check with the reserved position that what they read wasn't overwritten meanwhile.
+ *
+ * A mailbox is only created by its owner, and unlinked when it is closed. Writers never
+ * create one, so that nothing is left behind for clients which never connected.
+ */
+class ShmRing {
+public:
+    /**
+     * \brief Open a ring, creating it if needed.
+     * \param owner Owner of the mailbox, if it is created.
+     */
+    ShmRing(const std::string& name, size_t capacity, bool lossy, uint32_t owner = NO_DOORBELL)
+        : ShmRing(name, capacity, lossy, [capacity, lossy, owner](void *data) {
+              auto layout = new (data) Layout();
+              layout->capacity = ringCapacity(capacity);
+              layout->lossy = lossy;
+              layout->owner = owner;
+              initializeSharedMutex(&layout->mutex);
+          }) {
+    }
+
+    /**
+     * \brief Open an existing mailbox.
+     * \return nullptr if it doesn't exist.
+     */
+    static std::shared_ptr<ShmRing> openMailbox(const std::string& name) {
+        std::shared_ptr<ShmRing> ring(new ShmRing(name, 0, false, std::function<void(void*)>()));
+        return ring->m_layout ? ring : nullptr;
+    }
+
+    /**
+     * \brief Append a message.
+     * \param doorbells Doorbells of the endpoint, rung for the readers.
+     * \return false if the mailbox stayed full, or is closed.
+     * \throw MessageBusException if the message can't fit in the ring.
+     */
+    bool write(const std::string& subject, const Message& message, ShmDoorbells& doorbells) {
+        const size_t payload = encodedSize(subject, message);
+        const uint64_t record = recordSize(payload);
+        if (record > m_capacity / 2 || payload > UINT32_MAX) {
+            throw MessageBusException("Message too large for shared memory ring " + m_name);
+        }
+
+        {
+            SharedLock lock(&m_layout->mutex);
+            const uint64_t position = m_layout->writePosition.load(std::memory_order_relaxed);
+            const uint64_t tail = m_capacity - (position & (m_capacity - 1));
+            const uint64_t skip = tail < record ? tail : 0;
+
+            if (!m_layout->lossy && (closed() || !waitForRoom(position, skip + record, doorbells))) {
+                return false;
+            }
+
+            // Announce what is about to be overwritten before overwriting it.
+            uint64_t reserve = position + skip + record;
+            if (reserve > m_layout->reservePosition.load(std::memory_order_relaxed)) {
+                m_layout->reservePosition.store(reserve, std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+
+            if (skip) {
+                writeHeader(position, RECORD_WRAP, 0);
+            }
+            writeHeader(position + skip, RECORD_MESSAGE, uint32_t(payload));
+            encode(m_data + ((position + skip) & (m_capacity - 1)) + RECORD_HEADER, subject, message);
+            m_layout->writePosition.store(reserve, std::memory_order_release);
+        }
+
+        if (m_layout->lossy) {
+            for (uint32_t word = 0; word < MAX_CLIENTS / 64; word++) {
+                uint64_t subscribers = m_layout->subscribers[word].load();
+                while (subscribers) {
+                    uint32_t bit = uint32_t(__builtin_ctzll(subscribers));
+                    subscribers &= subscribers - 1;
+                    doorbells.ring(word * 64 + bit);
+                }
+            }
+        }
+        else {
+            uint32_t owner = m_layout->owner.load();
+            if (owner < MAX_CLIENTS) {
+                doorbells.ring(owner);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * \brief Read the next message of a mailbox (its owner only).
+     * \return false if there is none.
+     */
+    bool readMailbox(std::string& subject, Message& message) {
+        uint64_t position = m_layout->readPosition.load(std::memory_order_relaxed);
+        while (position < m_layout->writePosition.load(std::memory_order_acquire)) {
+            uint32_t kind, payload;
+            readHeader(position, kind, payload);
+
+            bool decoded = false;
+            if (kind == RECORD_WRAP) {
+                position += m_capacity - (position & (m_capacity - 1));
+            }
+            else {
+                decoded = decode(m_data + (position & (m_capacity - 1)) + RECORD_HEADER, payload, subject, message);
+                position += recordSize(payload);
+            }
+
+            // Make room for the writers.
+            m_layout->readPosition.store(position, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_layout->writersWaiting.load()) {
+                m_layout->readProgress.fetch_add(1);
+                futexWake(m_layout->readProgress);
+            }
+
+            if (decoded) {
+                return true;
+            }
+            if (kind != RECORD_WRAP) {
+                log_error("%s - corrupted record skipped", m_name.c_str());
+                message = Message();
+            }
+        }
+        return false;
+    }
+
+    /**
+     * \brief Read the next message of a topic.
+     * \param position Position of the reader, advanced past the message.
+     * \param lost Incremented when messages were overwritten before being read.
+     * \return false if there is none.
+     */
+    bool readTopic(uint64_t& position, std::string& subject, Message& message, uint64_t& lost) {
+        for (;;) {
+            const uint64_t end = m_layout->writePosition.load(std::memory_order_acquire);
+            if (position >= end) {
+                position = end;
+                return false;
+            }
+
+            uint32_t kind, payload;
+            readHeader(position, kind, payload);
+            const uint64_t offset = position & (m_capacity - 1);
+            bool decoded = kind == RECORD_MESSAGE && payload <= m_capacity - offset - RECORD_HEADER &&
+                decode(m_data + offset + RECORD_HEADER, payload, subject, message);
+
+            // Whatever was read is only valid if the writers didn't reserve over it meanwhile.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_layout->reservePosition.load(std::memory_order_relaxed) > position + m_capacity ||
+                (kind != RECORD_MESSAGE && kind != RECORD_WRAP)) {
+                lost++;
+                position = end;
+                message = Message();
+                continue;
+            }
+
+            position += kind == RECORD_WRAP ? m_capacity - offset : recordSize(payload);
+            if (decoded) {
+                return true;
+            }
+            message = Message();
+        }
+    }
+
+    uint64_t writePosition() const {
+        return m_layout->writePosition.load(std::memory_order_acquire);
+    }
+
+    /// \brief Become the owner of a mailbox, unless a live client is or it is closed.
+    bool own(uint32_t doorbell, const ShmDoorbells& doorbells) {
+        uint32_t owner = m_layout->owner.load();
+        while (owner == NO_DOORBELL || owner == doorbell || (owner < MAX_CLIENTS && !doorbells.alive(owner))) {
+            if (m_layout->owner.compare_exchange_weak(owner, doorbell)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * \brief Close a mailbox owned by a client, or by nobody alive, and unlink it.
+     *
+     * Writers which still have it mapped fail from then on, and look for a new one.
+     * \return false if another client owns it.
+     */
+    bool close(uint32_t doorbell, const ShmDoorbells& doorbells) {
+        uint32_t owner = m_layout->owner.load();
+        while (owner == NO_DOORBELL || owner == doorbell || (owner < MAX_CLIENTS && !doorbells.alive(owner))) {
+            if (m_layout->owner.compare_exchange_weak(owner, CLOSED_MAILBOX)) {
+                shm_unlink(m_name.c_str());
+                // Writers waiting for room give up.
+                m_layout->readProgress.fetch_add(1);
+                futexWake(m_layout->readProgress);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool closed() const {
+        return m_layout->owner.load() == CLOSED_MAILBOX;
+    }
+
+    const std::string& name() const {
+        return m_name;
+    }
+
+    void subscribe(uint32_t doorbell, bool subscribed) {
+        uint64_t bit = uint64_t(1) << (doorbell % 64);
+        if (subscribed) {
+            m_layout->subscribers[doorbell / 64].fetch_or(bit);
+        }
+        else {
+            m_layout->subscribers[doorbell / 64].fetch_and(~bit);
+        }
+    }
+
+private:
+    ShmRing(const std::string& name, size_t capacity, bool lossy, const std::function<void(void*)>& initialize)
+        : m_segment(name, sizeof(Layout) + ringCapacity(capacity), initialize),
+          m_layout(static_cast<Layout*>(m_segment.data())),
+          m_data(static_cast<char*>(m_segment.data()) + sizeof(Layout)),
+          m_capacity(m_layout ? m_layout->capacity : 0),
+          m_name(name) {
+        if (m_layout && (m_segment.size() < sizeof(Layout) + m_capacity || (m_capacity & (m_capacity - 1)) || bool(m_layout->lossy) != lossy)) {
+            throw MessageBusException("Shared memory segment " + name + " is not a " + (lossy ? "topic" : "mailbox"));
+        }
+    }
+
+    struct Layout {
+        std::atomic<uint32_t> ready{0};
+        uint32_t lossy = 0;
+        uint64_t capacity = 0;
+        pthread_mutex_t mutex;
+        alignas(64) std::atomic<uint64_t> writePosition{0};
+        std::atomic<uint64_t> reservePosition{0};
+        std::atomic<uint32_t> owner{NO_DOORBELL};
+        std::atomic<uint32_t> writersWaiting{0};
+        alignas(64) std::atomic<uint64_t> readPosition{0};
+        std::atomic<uint32_t> readProgress{0};
+        alignas(64) std::atomic<uint64_t> subscribers[MAX_CLIENTS / 64] {};
+    } ;
+
+    static uint64_t ringCapacity(size_t capacity) {
+        uint64_t ring = 4096;
+        while (ring < capacity) {
+            ring *= 2;
+        }
+        return ring;
+    }
+
+    // Wait for the reader of the mailbox to make room, for a while if it's connected.
+    bool waitForRoom(uint64_t position, uint64_t needed, ShmDoorbells& doorbells) {
+        auto deadline = std::chrono::steady_clock::now() + MAILBOX_FULL_TIMEOUT;
+        while (m_capacity - (position - m_layout->readPosition.load(std::memory_order_acquire)) < needed) {
+            uint32_t owner = m_layout->owner.load();
+            auto now = std::chrono::steady_clock::now();
+            if (owner >= MAX_CLIENTS || !doorbells.alive(owner) || now >= deadline) {
+                log_warning("%s - mailbox full, message dropped", m_name.c_str());
+                return false;
+            }
+
+            uint32_t progress = m_layout->readProgress.load();
+            m_layout->writersWaiting.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_capacity - (position - m_layout->readPosition.load()) < needed) {
+                futexWait(m_layout->readProgress, progress, std::min<std::chrono::nanoseconds>(deadline - now, std::chrono::milliseconds(10)));
+            }
+            m_layout->writersWaiting.fetch_sub(1);
+        }
+        return true;
+    }
+
+    void writeHeader(uint64_t position, uint32_t kind, uint32_t payload) {
+        char *header = m_data + (position & (m_capacity - 1));
+        memcpy(header, &kind, sizeof(kind));
+        memcpy(header + sizeof(kind), &payload, sizeof(payload));
+    }
+
+    void readHeader(uint64_t position, uint32_t& kind, uint32_t& payload) const {
+        const char *header = m_data + (position & (m_capacity - 1));
+        memcpy(&kind, header, sizeof(kind));
+        memcpy(&payload, header + sizeof(kind), sizeof(payload));
+    }
+
+    ShmSegment  m_segment;
+    Layout     *m_layout;
+    char       *m_data;
+    uint64_t    m_capacity;
+    std::string m_name;
+} ;
+
+    MessageBusSharedMemory::MessageBusSharedMemory(const std::string& endpoint, const std::string& clientName, size_t ringSize):
+        m_endpoint(endpoint),
+        m_clientName(clientName),
+        m_ringSize(ringSize),
+        m_doorbells(std::make_shared<ShmDoorbells>(endpoint)),
+        m_doorbell(m_doorbells->claim())
+    {
+    }
+
+    MessageBusSharedMemory::~MessageBusSharedMemory() {
+        if (m_receiver.joinable()) {
+            m_stopping = true;
+            m_doorbells->ring(m_doorbell);
+            m_receiver.join();
+        }
+
+        auto topicReaders = std::atomic_load(&m_topicReaders);
+        if (topicReaders) {
+            for (const auto& reader : *topicReaders) {
+                reader->ring->subscribe(m_doorbell, false);
+            }
+        }
+        if (m_mailbox) {
+            m_mailbox->close(m_doorbell, *m_doorbells);
+        }
+        m_doorbells->release(m_doorbell);
+    }
+
+    void MessageBusSharedMemory::connect() {
+        if (m_connected) {
+            throw MessageBusException("Already connected.");
+        }
+
+        reapMailboxes();
+
+        // Our mailbox is reused if we didn't close it (crashed), otherwise created.
+        std::string name = segmentName(m_endpoint, "mailbox", m_clientName);
+        auto deadline = std::chrono::steady_clock::now() + SEGMENT_READY_TIMEOUT;
+        for (;;) {
+            auto ring = std::make_shared<ShmRing>(name, m_ringSize, false, m_doorbell);
+            if (ring->own(m_doorbell, *m_doorbells)) {
+                m_mailbox = ring;
+                break;
+            }
+            if (!ring->closed()) {
+                throw MessageBusException("Client name already connected.");
+            }
+            // Closed, it is unlinked right after unless its closer died meanwhile.
+            if (std::chrono::steady_clock::now() >= deadline) {
+                shm_unlink(name.c_str());
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        {
+            std::unique_lock<std::mutex> lock(m_ringsMutex);
+            m_rings[name] = m_mailbox;
+        }
+
+        m_receiver = std::thread(&MessageBusSharedMemory::receiverMainloop, this);
+        m_connected = true;
+        log_trace ("%s - connected to shared memory endpoint '%s'", m_clientName.c_str(), m_endpoint.c_str());
+    }
+
+    void MessageBusSharedMemory::reapMailboxes() {
+        // Mailboxes of clients which died without closing them, except ours which we take over.
+        const std::string prefix = segmentName(m_endpoint, "mailbox", "").substr(1);
+        const std::string own = segmentName(m_endpoint, "mailbox", m_clientName).substr(1);
+        DIR *dir = opendir("/dev/shm");
+        if (!dir) {
+            return;
+        }
+        while (dirent *entry = readdir(dir)) {
+            std::string name(entry->d_name);
+            if (name.compare(0, prefix.size(), prefix) != 0 || name == own) {
+                continue;
+            }
+            try {
+                auto ring = ShmRing::openMailbox("/" + name);
+                if (ring && ring->close(NO_DOORBELL, *m_doorbells)) {
+                    log_debug ("%s - removed mailbox '%s' of a dead client", m_clientName.c_str(), name.c_str());
+                }
+            }
+            catch (const std::exception& e) {
+                log_debug ("%s - mailbox '%s' not reaped: %s", m_clientName.c_str(), name.c_str(), e.what());
+            }
+        }
+        closedir(dir);
+    }
+
+    std::shared_ptr<ShmRing> MessageBusSharedMemory::mailbox(const std::string& clientName) {
+        std::string name = segmentName(m_endpoint, "mailbox", clientName);
+        std::unique_lock<std::mutex> lock(m_ringsMutex);
+        auto iterator = m_rings.find(name);
+        if (iterator != m_rings.end()) {
+            return iterator->second;
+        }
+
+        // Only its owner creates a mailbox, there is none for a client not connected.
+        auto ring = ShmRing::openMailbox(name);
+        if (ring) {
+            m_rings.emplace(name, ring);
+        }
+        return ring;
+    }
+
+    bool MessageBusSharedMemory::writeMailbox(const std::string& to, const std::string& subject, const Message& message) {
+        for (int attempt = 0; attempt < 2; attempt++) {
+            auto ring = mailbox(to);
+            if (!ring) {
+                break;
+            }
+            if (ring->write(subject, message, *m_doorbells)) {
+                return true;
+            }
+            if (!ring->closed()) {
+                return false;
+            }
+
+            // Its owner disconnected since, look for the mailbox of a new connection.
+            std::unique_lock<std::mutex> lock(m_ringsMutex);
+            auto iterator = m_rings.find(ring->name());
+            if (iterator != m_rings.end() && iterator->second == ring) {
+                m_rings.erase(iterator);
+            }
+        }
+        log_warning("%s - '%s' is not connected, message to '%s' dropped", m_clientName.c_str(), to.c_str(), subject.c_str());
+        return false;
+    }
+
+    std::shared_ptr<ShmRing> MessageBusSharedMemory::topicRing(const std::string& topic) {
+        std::string name = segmentName(m_endpoint, "topic", topic);
+        std::unique_lock<std::mutex> lock(m_ringsMutex);
+        auto& ring = m_rings[name];
+        if (!ring) {
+            ring = std::make_shared<ShmRing>(name, m_ringSize, true);
+        }
+        return ring;
+    }
+
+    void MessageBusSharedMemory::publish(const std::string& topic, const Message& message) {
+        publish (topic, message, SendCompletion());
+    }
+
+    void MessageBusSharedMemory::publish(const std::string& topic, const Message& message, SendCompletion completion) {
+        if (!m_connected) {
+            throw MessageBusException("Not connected.");
+        }
+
+        log_trace ("%s - publishing on topic '%s'", m_clientName.c_str(), topic.c_str());
+        complete (std::move(completion), topicRing(topic)->write(topic, message, *m_doorbells));
+    }
+
+    SubscriptionHandle MessageBusSharedMemory::subscribe(const std::string& topic, MessageListener messageListener) {
+        {
+            std::unique_lock<std::mutex> lock(m_topicsMutex);
+            auto topicReaders = std::make_shared<TopicReaders>();
+            if (m_topicReaders) {
+                *topicReaders = *m_topicReaders;
+            }
+            auto it = std::find_if(topicReaders->begin(), topicReaders->end(), [&topic](const std::shared_ptr<TopicReader>& reader) { return reader->topic == topic; });
+            if (it == topicReaders->end()) {
+                auto ring = topicRing(topic);
+                ring->subscribe(m_doorbell, true);
+                // Only what is published from now on is received.
+                topicReaders->push_back(std::make_shared<TopicReader>(TopicReader{topic, ring, ring->writePosition()}));
+                std::atomic_store(&m_topicReaders, std::shared_ptr<const TopicReaders>(std::move(topicReaders)));
+            }
+        }
+
+        SubscriptionHandle handle = m_listeners.add (topic, messageListener);
+        log_trace ("%s - subscribed to topic '%s'", m_clientName.c_str(), topic.c_str());
+        return handle;
+    }
+
+    void MessageBusSharedMemory::unsubscribe(const std::string& topic, MessageListener /*messageListener*/) {
+        if (!m_listeners.remove (topic)) {
+            throw MessageBusException("Trying to unsubscribe on non-subscribed topic.");
+        }
+
+        {
+            std::unique_lock<std::mutex> topicsLock(m_topicsMutex);
+            auto topicReaders = std::make_shared<TopicReaders>();
+            for (const auto& reader : *m_topicReaders) {
+                if (reader->topic == topic) {
+                    reader->ring->subscribe(m_doorbell, false);
+                }
+                else {
+                    topicReaders->push_back(reader);
+                }
+            }
+            std::atomic_store(&m_topicReaders, std::shared_ptr<const TopicReaders>(std::move(topicReaders)));
+        }
+        log_trace ("%s - unsubscribed to topic '%s'", m_clientName.c_str(), topic.c_str());
+    }
+
+    void MessageBusSharedMemory::unsubscribe(SubscriptionHandle handle) {
+        std::string name = m_listeners.remove (handle);
+        log_trace ("%s - removed listener %" PRIu64 " of '%s'", m_clientName.c_str(), handle, name.c_str());
+    }
+
+    void MessageBusSharedMemory::sendRequest(const std::string& requestQueue, const Message& message) {
+        sendRequest (requestQueue, message, SendCompletion());
+    }
+
+    void MessageBusSharedMemory::sendRequest(const std::string& requestQueue, const Message& message, SendCompletion completion) {
+        sendMailbox (requestRecipient (m_clientName, requestQueue, message), requestQueue, message, std::move(completion));
+    }
+
+    void MessageBusSharedMemory::sendRequest(const std::string& requestQueue, const Message& message, MessageListener messageListener) {
+        receive(requestReplyQueue(message), messageListener);
+        sendRequest(requestQueue, message);
+    }
+
+    void MessageBusSharedMemory::sendReply(const std::string& replyQueue, const Message& message) {
+        sendReply (replyQueue, message, SendCompletion());
+    }
+
+    void MessageBusSharedMemory::sendReply(const std::string& replyQueue, const Message& message, SendCompletion completion) {
+        std::string to = replyRecipient (m_clientName, message);
+        if (to.empty()) {
+            complete (std::move(completion), false);
+            return;
+        }
+
+        sendMailbox (to, replyQueue, message, std::move(completion));
+    }
+
+    SubscriptionHandle MessageBusSharedMemory::receive(const std::string& queue, MessageListener messageListener) {
+        SubscriptionHandle handle = m_listeners.add (queue, messageListener);
+        log_trace ("%s - receive from queue '%s'", m_clientName.c_str(), queue.c_str());
+        return handle;
+    }
+
+    void MessageBusSharedMemory::setPriority(const std::string& name, Priority priority) {
+        m_priorities.set (name, priority);
+        log_trace ("%s - '%s' set to %s priority", m_clientName.c_str(), name.c_str(), priority == Priority::High ? "high" : "normal");
+    }
+
+    Message MessageBusSharedMemory::request(const std::string& requestQueue, const Message & message, int receiveTimeOut) {
+        if (!m_connected) {
+            throw MessageBusException("Not connected.");
+        }
+
+        std::string correlationId, to;
+        checkSyncRequest (message, correlationId, to);
+
+        Message msg(message);
+        // Adding metadata timeout.
+        msg.metaData().emplace(Message::TIMEOUT, std::to_string(receiveTimeOut));
+        msg.metaData().emplace(Message::REPLY_TO, m_clientName);
+
+        // Register before sending, the reply may come back before we wait for it.
+        SyncRequest syncRequest;
+        std::unique_lock<std::mutex> lock(m_cv_mtx);
+        if (!m_syncRequests.emplace (correlationId, &syncRequest).second) {
+            throw MessageBusException("Request with same correlation id already pending.");
+        }
+        lock.unlock();
+
+        bool sent = false;
+        try {
+            sent = writeMailbox(to, requestQueue, msg);
+        }
+        catch (...) {
+            lock.lock();
+            m_syncRequests.erase (correlationId);
+            throw;
+        }
+
+        lock.lock();
+        bool replied = sent && m_cv.wait_for(lock, std::chrono::seconds(receiveTimeOut), [&syncRequest]() { return syncRequest.replied; });
+        m_syncRequests.erase (correlationId);
+        if (!replied) {
+            throw MessageBusException("Request timed out.");
+        }
+        return std::move(syncRequest.response);
+    }
+
+    void MessageBusSharedMemory::sendMailbox(const std::string& to, const std::string& subject, const Message& message, SendCompletion completion) {
+        if (!m_connected) {
+            throw MessageBusException("Not connected.");
+        }
+
+        complete (std::move(completion), writeMailbox(to, subject, message));
+    }
+
+    void MessageBusSharedMemory::complete(SendCompletion&& completion, bool sent) {
+        // Completions are called from the receiver thread, like for the other buses.
+        if (completion) {
+            m_completions.push (std::make_pair(std::move(completion), sent));
+            m_doorbells->ring (m_doorbell);
+        }
+    }
+
+    void MessageBusSharedMemory::receiverMainloop() {
+        log_trace ("%s - receiver mainloop ready", m_clientName.c_str());
+
+        std::pair<SendCompletion, bool> completion;
+        while (!m_stopping) {
+            bool busy = false;
+            while (m_completions.pop (completion)) {
+                busy = true;
+                try {
+                    completion.first (completion.second);
+                }
+                catch (const std::exception& e) {
+                    log_error("Error in send completion: '%s'", e.what());
+                }
+                catch (...) {
+                    log_error("Error in send completion: 'unknown error'");
+                }
+                completion.first = nullptr;
+            }
+
+            busy = receiverRead () || busy;
+            if (!m_pending.empty()) {
+                receiverDispatchPending ();
+                continue;
+            }
+            if (busy) {
+                continue;
+            }
+
+            // Nothing to do, sleep until rung, checking a last time once announced.
+            uint32_t key = m_doorbells->prepareWait (m_doorbell);
+            if (receiverRead () || m_stopping) {
+                m_doorbells->cancelWait (m_doorbell);
+                continue;
+            }
+            m_doorbells->wait (m_doorbell, key, RECEIVER_SLEEP_MAX);
+        }
+
+        log_debug ("%s - receiver mainloop terminated", m_clientName.c_str());
+    }
+
+    bool MessageBusSharedMemory::receiverRead() {
+        bool read = false;
+        std::string subject;
+        Message message;
+
+        while (m_pending.size() < PENDING_DELIVERIES_MAX && m_mailbox->readMailbox (subject, message)) {
+            receiverDeliver ("queue", std::move(subject), std::move(message));
+            message = Message();
+            read = true;
+        }
+
+        auto topicReaders = std::atomic_load (&m_topicReaders);
+        if (topicReaders) {
+            for (const auto& reader : *topicReaders) {
+                uint64_t lost = 0;
+                while (m_pending.size() < PENDING_DELIVERIES_MAX && reader->ring->readTopic (reader->position, subject, message, lost)) {
+                    receiverDeliver ("topic", std::string(reader->topic), std::move(message));
+                    message = Message();
+                    read = true;
+                }
+                if (lost) {
+                    log_warning ("%s - messages of topic '%s' overwritten before being read", m_clientName.c_str(), reader->topic.c_str());
+                }
+            }
+        }
+        return read;
+    }
+
+    void MessageBusSharedMemory::receiverDeliver(const char *type, std::string&& name, Message&& message) {
+        if (type[0] == 'q') {
+            auto it = message.metaData().find(Message::CORRELATION_ID);
+            if( it != message.metaData().end() ) {
+                std::unique_lock<std::mutex> lock(m_cv_mtx);
+                auto syncRequest = m_syncRequests.find(it->second);
+                if( syncRequest != m_syncRequests.end() && !syncRequest->second->replied ) {
+                    syncRequest->second->response = std::move(message);
+                    syncRequest->second->replied = true;
+                    m_cv.notify_all();
+                    return;
+                }
+            }
+        }
+
+        bool high = m_priorities.isHigh (name);
+        m_pending.push (Delivery{type, std::move(name), std::move(message)}, high);
+    }
+
+    void MessageBusSharedMemory::receiverDispatchPending() {
+        Delivery delivery;
+        m_pending.pop (delivery);
+        if (!m_listeners.dispatch (delivery.type, delivery.name, delivery.message) && delivery.type[0] == 'q') {
+            log_warning("Message skipped");
+        }
+    }
+
+    MessageBus* SharedMemoryMessageBus(const std::string& endpoint, const std::string& clientName, size_t ringSize) {
+        return new messagebus::MessageBusSharedMemory(endpoint, clientName, ringSize);
+    }
+}
+
+#else
+
+namespace messagebus {
+
+    MessageBus* SharedMemoryMessageBus(const std::string& /*endpoint*/, const std::string& /*clientName*/, size_t /*ringSize*/) {
+        throw MessageBusException("Shared memory message bus not built.");
+    }
+}
+
+#endif
@@ -0,0 +1,164 @@
+/*  =========================================================================
+    fty_common_messagebus_shared_memory - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_COMMON_MESSAGEBUS_SHARED_MEMORY_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_SHARED_MEMORY_H_INCLUDED
+
+#include <string>
+
+#include "fty_common_messagebus_interface.h"
+#include "fty_common_messagebus_exception.h"
+#include "fty_common_messagebus_message.h"
+#include "fty_common_messagebus_bus_support.h"
+#include "fty_common_messagebus_mpsc_queue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace messagebus {
+
+    class ShmDoorbells;
+    class ShmRing;
+
+    /**
+     * \brief Message bus between the processes of a host, through shared memory.
+     *
+     * Addressing is the one of MessageBusMalamute. Every client has a mailbox ring and
+     * every topic a ring, memory-mapped from /dev/shm, written under a process-shared
+     * mutex and read without locks. Each client has a futex doorbell, rung by writers
+     * of its mailbox and of the topics it subscribed to, only when it sleeps.
+     *
+     * A full mailbox blocks its writers (for a while if its owner is connected). A
+     * topic overwrites its oldest messages, a reader lapped by the writers skips to
+     * the newest one and loses what was published meanwhile.
+     *
+     * A mailbox only exists while its owner is connected: messages sent to a client
+     * not connected are dropped (their completion gets false). It is unlinked when
+     * its bus is destroyed; the mailboxes of clients which crashed are unlinked by
+     * the next client connecting to the endpoint, unless the crashed client connects
+     * again first and takes its mailbox over. Topic segments are kept, there is one
+     * per topic.
+     */
+    class MessageBusSharedMemory : public MessageBus {
+      public:
+        MessageBusSharedMemory(const std::string& endpoint, const std::string& clientName, size_t ringSize);
+        ~MessageBusSharedMemory();
+
+        void connect() override;
+
+         // Async topic
+        void publish(const std::string& topic, const Message& message) override;
+        void publish(const std::string& topic, const Message& message, SendCompletion completion) override;
+        SubscriptionHandle subscribe(const std::string& topic, MessageListener messageListener) override;
+        void unsubscribe(const std::string& topic, MessageListener messageListener) override;
+        void unsubscribe(SubscriptionHandle handle) override;
+
+        // Async queue
+        void sendRequest(const std::string& requestQueue, const Message& message) override;
+        void sendRequest(const std::string& requestQueue, const Message& message, SendCompletion completion) override;
+        void sendRequest(const std::string& requestQueue, const Message& message, MessageListener messageListener) override;
+        void sendReply(const std::string& replyQueue, const Message& message) override;
+        void sendReply(const std::string& replyQueue, const Message& message, SendCompletion completion) override;
+        SubscriptionHandle receive(const std::string& queue, MessageListener messageListener) override;
+
+        void setPriority(const std::string& name, Priority priority) override;
+
+        // Sync queue
+        Message request(const std::string& requestQueue, const Message& message, int receiveTimeOut) override;
+
+      private:
+        // Message read from a ring, not dispatched yet.
+        struct Delivery {
+            const char *type = nullptr;
+            std::string name;
+            Message     message;
+        };
+
+        // Topic subscribed to, and how far it was read (receiver thread only).
+        struct TopicReader {
+            std::string              topic;
+            std::shared_ptr<ShmRing> ring;
+            uint64_t                 position;
+        };
+
+        // Number of messages read ahead of dispatching.
+        static constexpr size_t PENDING_DELIVERIES_MAX = 1024;
+
+        // Pending synchronous request, filled by the receiver thread.
+        struct SyncRequest {
+            bool    replied = false;
+            Message response;
+        };
+
+        using TopicReaders = std::vector<std::shared_ptr<TopicReader>>;
+
+        void reapMailboxes();
+        std::shared_ptr<ShmRing> mailbox(const std::string& clientName);
+        bool writeMailbox(const std::string& to, const std::string& subject, const Message& message);
+        std::shared_ptr<ShmRing> topicRing(const std::string& topic);
+        void sendMailbox(const std::string& to, const std::string& subject, const Message& message, SendCompletion completion);
+        void complete(SendCompletion&& completion, bool sent);
+
+        void receiverMainloop();
+        bool receiverRead();
+        void receiverDeliver(const char *type, std::string&& name, Message&& message);
+        void receiverDispatchPending();
+
+        std::string m_endpoint;
+        std::string m_clientName;
+        size_t      m_ringSize;
+
+        std::shared_ptr<ShmDoorbells> m_doorbells;
+        uint32_t                      m_doorbell;
+        std::shared_ptr<ShmRing>      m_mailbox;
+        std::atomic<bool>             m_connected{false};
+        std::atomic<bool>             m_stopping{false};
+        std::thread                   m_receiver;
+
+        // Rings written to, opened on first use and kept for the bus lifetime.
+        std::mutex m_ringsMutex;
+        std::map<std::string, std::shared_ptr<ShmRing>> m_rings;
+
+        // Completions of sends, called by the receiver thread.
+        MpscQueue<std::pair<SendCompletion, bool>> m_completions;
+
+        // Topics read, replaced (copy-on-write) on every change.
+        std::mutex m_topicsMutex;
+        std::shared_ptr<const TopicReaders> m_topicReaders;
+
+        ListenerRegistry m_listeners;
+        PriorityNames    m_priorities;
+
+        // Priority lanes of received messages (receiver thread only).
+        PriorityLanes<Delivery> m_pending;
+
+        std::condition_variable m_cv;
+        std::mutex m_cv_mtx;
+        std::map<std::string, SyncRequest*> m_syncRequests;
+    };
+}
+
+#endif
@@ -0,0 +1,163 @@
+/*  =========================================================================
+    fty_common_messagebus_strand - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_messagebus_strand -
+@discuss
+@end
+*/
+
+#include "fty_common_messagebus_classes.h"
+
+#include <deque>
+#include <mutex>
+
+namespace messagebus {
+
+namespace {
+
+// Jobs run in a row before giving the worker back to the pool.
+constexpr size_t STRAND_BURST = 16;
+
+// Strand running on the current thread, if any.
+thread_local const StrandState* t_strand = nullptr;
+
+}
+
+/**
+ * \brief State of a Strand or a ConcurrencyLimit, shared with the work scheduled on the pool.
+ *
+ * Work is queued, and up to m_limit drains are scheduled on the pool to run it.
+ * m_running counts the drains scheduled, a drain only stops once the queue is
+ * empty. With a limit of 1, the work runs one at a time and in order.
+ */
+class StrandState : public std::enable_shared_from_this<StrandState> {
+public:
+    StrandState(PoolWorker& pool, size_t limit) : m_pool(pool), m_limit(limit), m_running(0) { }
+
+    void post(WorkUnit&& work) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_waiting.push_back(std::move(work));
+            if (m_running >= m_limit) {
+                return;
+            }
+            m_running++;
+        }
+
+        try {
+            schedule();
+        }
+        catch (std::exception&) {
+            // The pool is terminating, don't leave the work behind.
+            drain();
+        }
+    }
+
+    bool runningInThisThread() const {
+        return t_strand == this;
+    }
+
+private:
+    void schedule() {
+        auto self = shared_from_this();
+        m_pool.offload([self]() { self->drain(); });
+    }
+
+    void drain() {
+        const StrandState* previous = t_strand;
+        t_strand = this;
+
+        for (size_t done = 1;; done++) {
+            WorkUnit work;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_waiting.empty()) {
+                    m_running--;
+                    break;
+                }
+                work = std::move(m_waiting.front());
+                m_waiting.pop_front();
+            }
+
+            try {
+                work();
+            }
+            catch (std::exception& e) {
+                log_error("Uncaught exception in strand: %s", e.what());
+            }
+            catch (...) {
+                log_error("Uncaught exception in strand");
+            }
+            work = nullptr;
+
+            if (done >= STRAND_BURST) {
+                // Give the worker back, unless the pool is terminating.
+                try {
+                    schedule();
+                    break;
+                }
+                catch (std::exception&) {
+                    done = 0;
+                }
+            }
+        }
+
+        t_strand = previous;
+    }
+
+    PoolWorker& m_pool;
+    const size_t m_limit;
+    std::mutex m_mutex;
+    size_t m_running;
+    std::deque<WorkUnit> m_waiting;
+} ;
+
+Strand::Strand(PoolWorker& pool) : m_state(std::make_shared<StrandState>(pool, 1)) {
+}
+
+Strand::~Strand() {
+}
+
+void Strand::post(WorkUnit&& work) {
+    m_state->post(std::move(work));
+}
+
+bool Strand::runningInThisThread() const {
+    return m_state->runningInThisThread();
+}
+
+ConcurrencyLimit::ConcurrencyLimit(PoolWorker& pool, size_t limit) {
+    if (limit == 0) {
+        throw std::invalid_argument("ConcurrencyLimit must be at least 1");
+    }
+    m_state = std::make_shared<StrandState>(pool, limit);
+}
+
+ConcurrencyLimit::~ConcurrencyLimit() {
+}
+
+void ConcurrencyLimit::post(WorkUnit&& work) {
+    m_state->post(std::move(work));
+}
+
+}
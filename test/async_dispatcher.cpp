@@ -0,0 +1,146 @@
+#include "fty_common_messagebus_async_dispatcher.h"
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("AsyncDispatcher")
+{
+    std::cerr << " * fty_common_messagebus_async_dispatcher: " << std::endl;
+    using namespace messagebus;
+
+    {
+        std::cerr << "  - calculator: ";
+
+        using Calculator = AsyncDispatcher<std::string, std::function<int(int, int)>, std::function<int(const std::string&, int, int)>>;
+        PoolWorker pool(4);
+        Calculator calculator(pool, {
+            { "+", [](int a, int b) -> int { return a + b; }},
+            { "*", [](int a, int b) -> int { return a * b; }},
+        }, [](const std::string& key, int, int) -> int { return int(key.size()); });
+
+        std::vector<std::future<int>> sums;
+        for (int i = 0; i < 100; i++) {
+            sums.push_back(calculator.schedule("+", i, 1));
+        }
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(sums[i].get() == i + 1);
+        }
+        REQUIRE(calculator.schedule(std::string("*"), 6, 7).get() == 42);
+        REQUIRE(calculator.schedule("unknown", 6, 7).get() == 7);
+
+        Calculator noDefault(pool, { { "+", [](int a, int b) -> int { return a + b; }} });
+        REQUIRE_THROWS_AS(noDefault.schedule("-", 2, 3).get(), std::bad_function_call);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - map of a Dispatcher: ";
+
+        using Transparent = TransparentDispatcher<std::string, std::function<int(int, int)>, std::function<int(const std::string&, int, int)>>;
+        using Calculator  = AsyncDispatcher<std::string, std::function<int(int, int)>, std::function<int(const std::string&, int, int)>, Transparent::Map>;
+        using Hashed      = HashDispatcher<std::string, std::function<int(int, int)>, std::function<int(const std::string&, int, int)>>;
+        using HashedCalculator = AsyncDispatcher<std::string, std::function<int(int, int)>, std::function<int(const std::string&, int, int)>, Hashed::Map>;
+        PoolWorker pool(2);
+
+        Calculator calculator(pool, { { "+", [](int a, int b) -> int { return a + b; }} });
+        REQUIRE(calculator.schedule("+", 2, 3).get() == 5);
+
+        HashedCalculator hashed(pool, { { "+", [](int a, int b) -> int { return a + b; }} });
+        REQUIRE(hashed.schedule("+", 2, 3).get() == 5);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - offload and arguments copies: ";
+
+        using Notifier = AsyncDispatcher<std::string, std::function<void(std::string, std::promise<std::string>&)>, std::function<void(const std::string&, std::string, std::promise<std::string>&)>>;
+        PoolWorker pool(2);
+        Notifier notifier(pool, {
+            { "echo", [](std::string value, std::promise<std::string>& result) { result.set_value(value); }},
+        });
+
+        std::promise<std::string> result;
+        {
+            std::string value = "temporary";
+            notifier.offload("echo", value, std::ref(result));
+        }
+        REQUIRE(result.get_future().get() == "temporary");
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - concurrency limits: ";
+
+        using Commands = AsyncDispatcher<std::string, std::function<void(int)>, std::function<void(const std::string&, int)>>;
+        PoolWorker pool(8);
+
+        std::atomic<int> running(0);
+        std::atomic<int> maxRunning(0);
+        // Unsynchronized, only safe if serial calls never overlap.
+        std::vector<int> order;
+
+        Commands commands(pool, {
+            { "heavy", [&](int) {
+                int now = ++running;
+                int max = maxRunning.load();
+                while (now > max && !maxRunning.compare_exchange_weak(max, now)) { }
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+                running--;
+            }},
+            { "serial", [&](int index) {
+                order.push_back(index);
+            }},
+        }, {}, { { "heavy", 2 }, { "serial", 1 } });
+
+        std::vector<std::future<void>> done;
+        for (int i = 0; i < 100; i++) {
+            done.push_back(commands.schedule("heavy", i));
+            done.push_back(commands.schedule("serial", i));
+        }
+        for (auto& future : done) {
+            future.get();
+        }
+        REQUIRE(maxRunning <= 2);
+        REQUIRE(order.size() == 100);
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(order[i] == i);
+        }
+
+        REQUIRE_THROWS_AS(Commands(pool, {}, {}, { { "none", 0 } }), std::invalid_argument);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - offload failures are logged: ";
+
+        using Commands = AsyncDispatcher<std::string, std::function<void(int)>, std::function<void(const std::string&, int)>>;
+        std::atomic<int> calls(0);
+        {
+            std::unique_ptr<PoolWorker> pool(new PoolWorker(2));
+            Commands commands(*pool, {
+                { "throw", [&](int) { calls++; throw std::runtime_error("failed on purpose"); }},
+            }, {}, { { "limited", 1 } });
+
+            for (int i = 0; i < 100; i++) {
+                commands.offload("throw", i);
+                commands.offload("unknown", i);
+                commands.offload("limited", i);
+            }
+            // The pool waits for the work offloaded when it is destroyed, the dispatcher must outlive it.
+            pool.reset();
+        }
+        REQUIRE(calls == 100);
+
+        std::cerr << "OK" << std::endl;
+    }
+}
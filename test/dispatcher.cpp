@@ -2,6 +2,8 @@
 #include <catch2/catch.hpp>
 
 #include <iostream>
+#include <map>
+#include <memory>
 #include <set>
 
 TEST_CASE("Dispatcher")
@@ -59,3 +61,168 @@ TEST_CASE("Dispatcher")
         std::cerr << "OK" << std::endl;
     }
 }
+
+TEST_CASE("Dispatcher variants")
+{
+    std::cerr << " * fty_common_messagebus_dispatcher (variants): " << std::endl;
+
+    using namespace messagebus;
+
+    {
+        std::cerr << "  - hash and perfect hash calculators: ";
+
+        using Work    = std::function<int(int, int)>;
+        using Missing = std::function<int(const std::string&, int, int)>;
+
+        HashDispatcher<std::string, Work, Missing> hashCalculator({
+            { "+", [](int a, int b) -> int { return a + b; }},
+            { "-", [](int a, int b) -> int { return a - b; }},
+        });
+        PerfectHashDispatcher<std::string, Work, Missing> perfectHashCalculator({
+            { "+", [](int a, int b) -> int { return a + b; }},
+            { "-", [](int a, int b) -> int { return a - b; }},
+        }, [](const std::string&, int, int) -> int { return 0; });
+
+        REQUIRE(hashCalculator("+", 2, 3) == 5);
+        REQUIRE(hashCalculator("-", 2, 3) == -1);
+        REQUIRE_THROWS_AS(hashCalculator("*", 2, 3), std::bad_function_call);
+        REQUIRE(perfectHashCalculator("+", 2, 3) == 5);
+        REQUIRE(perfectHashCalculator("-", 2, 3) == -1);
+        REQUIRE(perfectHashCalculator("*", 2, 3) == 0);
+        REQUIRE(hashCalculator.canDispatch("+"));
+        REQUIRE(!hashCalculator.canDispatch("*"));
+        REQUIRE(perfectHashCalculator.canDispatch("*"));
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - perfect hash map: ";
+
+        for (size_t size : { 0, 1, 2, 3, 50, 1000 }) {
+            std::map<std::string, size_t> strings;
+            std::map<int, size_t>         integers;
+            std::map<uint64_t, size_t>    aligned;
+            for (size_t i = 0; i < size; i++) {
+                strings.emplace("subject-" + std::to_string(i), i);
+                integers.emplace(int(i * 4096), i);
+                // Identity hashes with equal low bits.
+                aligned.emplace(uint64_t(i) << 32, i);
+            }
+
+            PerfectHashMap<std::string, size_t> stringMap(strings.begin(), strings.end());
+            PerfectHashMap<int, size_t>         integerMap(integers.begin(), integers.end());
+            PerfectHashMap<uint64_t, size_t>    alignedMap(aligned.begin(), aligned.end());
+            REQUIRE(stringMap.size() == size);
+            REQUIRE(integerMap.size() == size);
+
+            for (size_t i = 0; i < size; i++) {
+                REQUIRE(stringMap.at("subject-" + std::to_string(i)) == i);
+                REQUIRE(integerMap.at(int(i * 4096)) == i);
+                REQUIRE(alignedMap.at(uint64_t(i) << 32) == i);
+            }
+            REQUIRE(stringMap.find("subject-" + std::to_string(size)) == stringMap.end());
+            REQUIRE(stringMap.find("") == stringMap.end());
+            REQUIRE(integerMap.find(1) == integerMap.end());
+        }
+
+        REQUIRE_THROWS_AS((PerfectHashMap<std::string, int>({ { "a", 1 }, { "a", 2 } })), std::invalid_argument);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - heterogeneous lookup: ";
+
+        using Work    = std::function<std::string(int)>;
+        using Missing = std::function<std::string(const std::string&, int)>;
+        auto missing  = [](const std::string& key, int) -> std::string { return "missing " + key; };
+
+        TransparentDispatcher<std::string, Work, Missing> treeDispatcher({ { "subject", [](int a) { return std::to_string(a); } } }, missing);
+        Dispatcher<std::string, Work, Missing>            defaultDispatcher({ { "subject", [](int a) { return std::to_string(a); } } }, missing);
+        HashDispatcher<std::string, Work, Missing>        hashDispatcher({ { "subject", [](int a) { return std::to_string(a); } } }, missing);
+        PerfectHashDispatcher<std::string, Work, Missing> perfectHashDispatcher({ { "subject", [](int a) { return std::to_string(a); } } }, missing);
+
+        const char *subject = "subject";
+        std::string_view view(subject);
+        REQUIRE(treeDispatcher(subject, 1) == "1");
+        REQUIRE(treeDispatcher(view, 2) == "2");
+        REQUIRE(treeDispatcher(std::string(subject), 3) == "3");
+        REQUIRE(treeDispatcher("other", 0) == "missing other");
+        REQUIRE(defaultDispatcher(subject, 1) == "1");
+        REQUIRE(defaultDispatcher(view, 2) == "2");
+        REQUIRE(defaultDispatcher("other", 0) == "missing other");
+        REQUIRE(hashDispatcher(subject, 1) == "1");
+        REQUIRE(hashDispatcher(view, 2) == "2");
+        REQUIRE(hashDispatcher(std::string_view("other"), 0) == "missing other");
+        REQUIRE(perfectHashDispatcher(subject, 1) == "1");
+        REQUIRE(perfectHashDispatcher(view, 2) == "2");
+        REQUIRE(perfectHashDispatcher(view.substr(0, 3), 0) == "missing sub");
+
+        PerfectHashMap<std::string, int> map({ { "a", 1 }, { "bb", 2 } });
+        REQUIRE(map.find(std::string_view("bb"))->second == 2);
+        REQUIRE(map.find("a")->second == 1);
+        REQUIRE(map.find("c") == map.end());
+
+        // The map is moved in, not copied.
+        using MoveDispatcher = Dispatcher<int, std::function<int()>, std::function<int(int)>>;
+        auto counter = std::make_shared<int>(0);
+        MoveDispatcher::Map moveMap { { 1, [counter]() { return ++*counter; } } };
+        MoveDispatcher moved(std::move(moveMap));
+        REQUIRE(counter.use_count() == 2);
+        REQUIRE(moved(1) == 1);
+
+        // Existing maps with the default comparator are still accepted.
+        std::map<int, std::function<int()>> plainMap { { 2, []() { return 2; } } };
+        MoveDispatcher plain(plainMap);
+        REQUIRE(plain(2) == 2);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - static dispatcher: ";
+
+        using Work    = int (*)(int, int);
+        using Missing = int (*)(std::string_view, int, int);
+        struct Operations {
+            static constexpr int add(int a, int b) { return a + b; }
+            static constexpr int sub(int a, int b) { return a - b; }
+            static constexpr int mul(int a, int b) { return a * b; }
+            static constexpr int div(int a, int b) { return a / b; }
+            static constexpr int unknown(std::string_view, int, int) { return 0; }
+        } ;
+
+        static constexpr auto calculator = makeStaticDispatcher<Work>({
+            { "+", Operations::add },
+            { "-", Operations::sub },
+            { "*", Operations::mul },
+            { "/", Operations::div },
+        }, Missing(Operations::unknown));
+
+        // Resolved at compile time.
+        static_assert(calculator.size() == 4, "static dispatcher size");
+        static_assert(calculator("*", 6, 7) == 42, "static dispatcher lookup");
+        static_assert(calculator("%", 6, 7) == 0, "static dispatcher default handler");
+
+        for (int b = 1; b < 10; b++) {
+            for (int a = 1; a < 10; a++) {
+                REQUIRE(calculator("+", a, b) == (a+b));
+                REQUIRE(calculator("-", a, b) == (a-b));
+                REQUIRE(calculator(std::string("*"), a, b) == (a*b));
+                REQUIRE(calculator("/", a, b) == (a/b));
+            }
+        }
+        REQUIRE(calculator("", 2, 3) == 0);
+        REQUIRE(calculator("++", 2, 3) == 0);
+
+        StaticDispatcher<Work, Missing, 2> noDefault({ { { "+", Operations::add }, { "-", Operations::sub } } });
+        REQUIRE(noDefault("-", 2, 3) == -1);
+        REQUIRE_THROWS_AS(noDefault("*", 2, 3), std::bad_function_call);
+
+        using Subjects = StaticDispatcher<Work, Missing, 2>;
+        REQUIRE_THROWS_AS(Subjects({ { { "a", Operations::add }, { "a", Operations::sub } } }), std::invalid_argument);
+
+        std::cerr << "OK" << std::endl;
+    }
+}
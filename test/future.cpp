@@ -0,0 +1,97 @@
+#include "fty_common_messagebus_future.h"
+#include <catch2/catch.hpp>
+
+#include <iostream>
+#include <string>
+
+TEST_CASE("Future")
+{
+    std::cerr << " * fty_common_messagebus_future: " << std::endl;
+    using namespace messagebus;
+
+    for (size_t workers : { 0, 4 }) {
+        std::cerr << "  - Continuations with PoolWorker(" << workers << "): ";
+
+        PoolWorker pool(workers);
+
+        // Fetch, transform, reply.
+        auto reply = async(pool, [](int id) { return id * 2; }, 21)
+            .then([](int value) { return std::to_string(value); })
+            .then([](std::string value) { return "reply " + value; });
+        REQUIRE(reply.get() == "reply 42");
+        REQUIRE(!reply.valid());
+
+        // Void and move-only values.
+        std::atomic<int> calls(0);
+        auto chained = async(pool, [&calls]() { calls++; })
+            .then([&calls]() {
+                calls++;
+                return std::unique_ptr<int>(new int(7));
+            })
+            .then([](std::unique_ptr<int> value) { return *value; });
+        REQUIRE(chained.get() == 7);
+        REQUIRE(calls == 2);
+
+        // Exceptions skip the continuations.
+        std::atomic<bool> skipped(true);
+        auto failed = async(pool, []() -> int { throw std::runtime_error("failed"); })
+            .then([&skipped](int value) {
+                skipped = false;
+                return value;
+            });
+        REQUIRE_THROWS_AS(failed.get(), std::runtime_error);
+        REQUIRE(skipped);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - whenAll and whenAny: ";
+
+        PoolWorker pool(4);
+
+        std::vector<Future<int>> futures;
+        for (int i = 0; i < 100; i++) {
+            futures.push_back(async(pool, [](int value) { return value * value; }, i));
+        }
+        auto sum = whenAll(pool, std::move(futures)).then([](std::vector<int> values) {
+            // Values are in order.
+            int total = 0;
+            for (size_t i = 0; i < values.size(); i++) {
+                total += values[i] == int(i * i) ? values[i] : -1000000;
+            }
+            return total;
+        });
+        REQUIRE(sum.get() == 328350);
+
+        REQUIRE(whenAll(pool, std::vector<Future<int>>()).get().empty());
+
+        std::vector<Future<void>> voids;
+        std::atomic<int> done(0);
+        for (int i = 0; i < 10; i++) {
+            voids.push_back(async(pool, [&done]() { done++; }));
+        }
+        whenAll(pool, std::move(voids)).get();
+        REQUIRE(done == 10);
+
+        std::promise<void> release;
+        auto blocker = release.get_future().share();
+        std::vector<Future<std::string>> racers;
+        racers.push_back(async(pool, [blocker]() {
+            blocker.wait();
+            return std::string("slow");
+        }));
+        racers.push_back(async(pool, []() { return std::string("fast"); }));
+        auto first = whenAny(pool, std::move(racers)).get();
+        release.set_value();
+        REQUIRE(first.first == 1);
+        REQUIRE(first.second == "fast");
+
+        std::vector<Future<int>> failing;
+        failing.push_back(async(pool, []() -> int { throw std::runtime_error("failed"); }));
+        failing.push_back(async(pool, []() { return 1; }));
+        REQUIRE_THROWS_AS(whenAll(pool, std::move(failing)).get(), std::runtime_error);
+
+        std::cerr << "OK" << std::endl;
+    }
+}
@@ -0,0 +1,119 @@
+#include "fty_common_messagebus_interface.h"
+#include "fty_common_messagebus_message.h"
+#include "fty_common_messagebus_exception.h"
+#include "fty_common_messagebus_rpc_server.h"
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+TEST_CASE("InProcessMessageBus")
+{
+    std::cerr << " * fty_common_messagebus_inprocess: " << std::endl;
+    using namespace messagebus;
+
+    {
+        std::cerr << "  - topics: ";
+
+        constexpr size_t NB_MESSAGES = 1000;
+        std::vector<std::string> received[2];
+        std::promise<void> done[2];
+        std::atomic<size_t> strays(0);
+
+        // Declared after the state of their listeners, to be destroyed before it.
+        std::unique_ptr<MessageBus> publisher(InProcessMessageBus("inproc://topics", "publisher"));
+        std::unique_ptr<MessageBus> first(InProcessMessageBus("inproc://topics", "first"));
+        std::unique_ptr<MessageBus> second(InProcessMessageBus("inproc://topics", "second"));
+        std::unique_ptr<MessageBus> elsewhere(InProcessMessageBus("inproc://elsewhere", "first"));
+        publisher->connect();
+        first->connect();
+        second->connect();
+        elsewhere->connect();
+
+        for (size_t i = 0; i < 2; i++) {
+            (i ? second : first)->subscribe("metrics", [&received, &done, i](const Message& message) {
+                received[i].push_back(message.userData().front());
+                if (received[i].size() == NB_MESSAGES) {
+                    done[i].set_value();
+                }
+            });
+        }
+        elsewhere->subscribe("metrics", [&strays](const Message&) { strays++; });
+
+        std::atomic<size_t> completed(0);
+        for (size_t i = 0; i < NB_MESSAGES; i++) {
+            publisher->publish("metrics", Message({}, { std::to_string(i) }), [&completed](bool sent) {
+                if (sent) {
+                    completed++;
+                }
+            });
+        }
+        for (size_t i = 0; i < 2; i++) {
+            REQUIRE(done[i].get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+            for (size_t j = 0; j < NB_MESSAGES; j++) {
+                REQUIRE(received[i][j] == std::to_string(j));
+            }
+        }
+        REQUIRE(strays == 0);
+
+        // Completions are called from the dispatcher thread of the publisher.
+        std::promise<void> flushed;
+        publisher->publish("metrics", Message({}, { "flush" }), [&flushed](bool) { flushed.set_value(); });
+        flushed.get_future().wait();
+        REQUIRE(completed == NB_MESSAGES);
+
+        REQUIRE_THROWS_AS(std::unique_ptr<MessageBus>(InProcessMessageBus("inproc://topics", "first"))->connect(), MessageBusException);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - requests and replies: ";
+
+        std::unique_ptr<MessageBus> server(InProcessMessageBus("inproc://rpc", "server"));
+        std::unique_ptr<MessageBus> client(InProcessMessageBus("inproc://rpc", "client"));
+        server->connect();
+        client->connect();
+
+        RpcServer rpc(*server, "server.queue", RpcServer::Handlers({
+            { "echo", [](const Message& request) -> UserData { return request.userData(); } },
+        }));
+
+        Message request({
+            { Message::SUBJECT, "echo" },
+            { Message::FROM, "client" },
+            { Message::TO, "server" },
+            { Message::CORRELATION_ID, "id-1" },
+        }, { "hello" });
+
+        // Synchronous.
+        Message reply = client->request("server.queue", request, 10);
+        REQUIRE(reply.metaData().at(Message::CORRELATION_ID) == "id-1");
+        REQUIRE(reply.metaData().at(Message::STATUS) == STATUS_OK);
+        REQUIRE(reply.userData() == UserData{ "hello" });
+
+        // Asynchronous.
+        std::promise<Message> asyncReply;
+        request.metaData()[Message::CORRELATION_ID] = "id-2";
+        request.metaData()[Message::REPLY_TO] = "client.replies";
+        client->sendRequest("server.queue", request, [&asyncReply](const Message& message) { asyncReply.set_value(message); });
+        auto future = asyncReply.get_future();
+        REQUIRE(future.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+        reply = future.get();
+        REQUIRE(reply.metaData().at(Message::CORRELATION_ID) == "id-2");
+        REQUIRE(reply.userData() == UserData{ "hello" });
+
+        // Nobody to send to.
+        request.metaData()[Message::TO] = "nobody";
+        REQUIRE_THROWS_AS(client->request("server.queue", request, 10), MessageBusException);
+        std::promise<bool> dropped;
+        client->sendRequest("server.queue", request, [&dropped](bool sent) { dropped.set_value(sent); });
+        REQUIRE(!dropped.get_future().get());
+
+        std::cerr << "OK" << std::endl;
+    }
+}
@@ -0,0 +1,121 @@
+#include "fty_common_messagebus_instrumented_dispatcher.h"
+#include <catch2/catch.hpp>
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("InstrumentedDispatcher")
+{
+    std::cerr << " * fty_common_messagebus_instrumented_dispatcher: " << std::endl;
+    using namespace messagebus;
+
+    {
+        std::cerr << "  - calls, errors and latency: ";
+
+        using Calculator = InstrumentedDispatcher<std::string, std::function<int(int, int)>, std::function<int(const std::string&, int, int)>>;
+        Calculator calculator({
+            { "+", [](int a, int b) -> int { return a + b; }},
+            { "/", [](int a, int b) -> int {
+                if (b == 0) {
+                    throw std::domain_error("division by zero");
+                }
+                return a / b;
+            }},
+            { "sleep", [](int a, int) -> int {
+                std::this_thread::sleep_for(std::chrono::milliseconds(a));
+                return a;
+            }},
+        }, [](const std::string&, int, int) -> int { return 0; });
+
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(calculator("+", i, 1) == i + 1);
+        }
+        REQUIRE(calculator("/", 6, 3) == 2);
+        REQUIRE_THROWS_AS(calculator("/", 6, 0), std::domain_error);
+        REQUIRE(calculator("sleep", 5, 0) == 5);
+        REQUIRE(calculator("unknown", 1, 1) == 0);
+        REQUIRE(calculator(std::string_view("other"), 1, 1) == 0);
+
+        auto snapshot = calculator.snapshot();
+        REQUIRE(snapshot.keys.size() == 3);
+        REQUIRE(snapshot.keys["+"].calls == 100);
+        REQUIRE(snapshot.keys["+"].errors == 0);
+        REQUIRE(snapshot.keys["+"].latency.count == 100);
+        REQUIRE(snapshot.keys["/"].calls == 2);
+        REQUIRE(snapshot.keys["/"].errors == 1);
+        REQUIRE(snapshot.keys["sleep"].calls == 1);
+        REQUIRE(snapshot.keys["sleep"].latency.max >= std::chrono::milliseconds(5));
+        REQUIRE(snapshot.keys["sleep"].latency.percentile(50) >= std::chrono::milliseconds(4));
+        REQUIRE(snapshot.missing.calls == 2);
+        REQUIRE(snapshot.missing.errors == 0);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - unknown keys without default handler: ";
+
+        InstrumentedDispatcher<int, std::function<void()>, std::function<void(int)>> dispatcher({ { 1, []() {} } });
+        dispatcher(1);
+        REQUIRE_THROWS_AS(dispatcher(2), std::bad_function_call);
+
+        auto snapshot = dispatcher.snapshot();
+        REQUIRE(snapshot.keys[1].calls == 1);
+        REQUIRE(snapshot.missing.calls == 1);
+        REQUIRE(snapshot.missing.errors == 1);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - map of a Dispatcher: ";
+
+        using Perfect = PerfectHashDispatcher<std::string, std::function<int(int)>, std::function<int(const std::string&, int)>>;
+        InstrumentedDispatcher<std::string, std::function<int(int)>, std::function<int(const std::string&, int)>, Perfect::Map> dispatcher({
+            { "double", [](int a) -> int { return a * 2; } },
+            { "negate", [](int a) -> int { return -a; } },
+        }, [](const std::string&, int) -> int { return 0; });
+
+        REQUIRE(dispatcher("double", 21) == 42);
+        REQUIRE(dispatcher(std::string("negate"), 1) == -1);
+        REQUIRE(dispatcher("unknown", 1) == 0);
+
+        auto snapshot = dispatcher.snapshot();
+        REQUIRE(snapshot.keys["double"].calls == 1);
+        REQUIRE(snapshot.keys["negate"].calls == 1);
+        REQUIRE(snapshot.missing.calls == 1);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - concurrent calls: ";
+
+        InstrumentedDispatcher<std::string, std::function<void()>, std::function<void(const std::string&)>> dispatcher({
+            { "a", []() {} },
+            { "b", []() {} },
+        });
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&dispatcher]() {
+                for (int i = 0; i < 10000; i++) {
+                    dispatcher(i % 2 ? "a" : "b");
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        auto snapshot = dispatcher.snapshot();
+        REQUIRE(snapshot.keys["a"].calls == 20000);
+        REQUIRE(snapshot.keys["b"].calls == 20000);
+        REQUIRE(snapshot.keys["a"].latency.count == 20000);
+
+        std::cerr << "OK" << std::endl;
+    }
+}
@@ -0,0 +1,179 @@
+#include "fty_common_messagebus_interface.h"
+#include "fty_common_messagebus_message.h"
+#include "fty_common_messagebus_exception.h"
+#include "fty_common_messagebus_rpc_server.h"
+#include "malamute_broker.h"
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+TEST_CASE("MlmMessageBus")
+{
+    std::cerr << " * fty_common_messagebus_malamute: " << std::endl;
+    using namespace messagebus;
+
+    MalamuteBroker broker("inproc://malamute-test");
+
+    {
+        std::cerr << "  - topics: ";
+
+        constexpr size_t NB_MESSAGES = 1000;
+        std::vector<std::string> received[2];
+        std::promise<void> done[2];
+
+        // Declared after the state of their listeners, to be destroyed before it.
+        std::unique_ptr<MessageBus> publisher(MlmMessageBus(broker.endpoint(), "publisher"));
+        std::unique_ptr<MessageBus> first(MlmMessageBus(broker.endpoint(), "first"));
+        std::unique_ptr<MessageBus> second(MlmMessageBus(broker.endpoint(), "second"));
+        publisher->connect();
+        first->connect();
+        second->connect();
+
+        for (size_t i = 0; i < 2; i++) {
+            (i ? second : first)->subscribe("metrics", [&received, &done, i](const Message& message) {
+                received[i].push_back(message.userData().front());
+                if (received[i].size() == NB_MESSAGES) {
+                    done[i].set_value();
+                }
+            });
+        }
+        // Subscriptions are asynchronous, let the broker register them.
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        std::atomic<size_t> completed(0);
+        for (size_t i = 0; i < NB_MESSAGES; i++) {
+            publisher->publish("metrics", Message({}, { std::to_string(i) }), [&completed](bool sent) {
+                if (sent) {
+                    completed++;
+                }
+            });
+            // The publisher switches stream back and forth.
+            if (i % 10 == 0) {
+                publisher->publish("alarms", Message({}, { std::to_string(i) }));
+            }
+        }
+        for (size_t i = 0; i < 2; i++) {
+            REQUIRE(done[i].get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+            for (size_t j = 0; j < NB_MESSAGES; j++) {
+                REQUIRE(received[i][j] == std::to_string(j));
+            }
+        }
+
+        // Completions are called from the listener thread of the publisher, in order.
+        std::promise<void> flushed;
+        publisher->publish("metrics", Message({}, { "flush" }), [&flushed](bool) { flushed.set_value(); });
+        flushed.get_future().wait();
+        REQUIRE(completed == NB_MESSAGES);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - requests and replies: ";
+
+        std::unique_ptr<MessageBus> server(MlmMessageBus(broker.endpoint(), "server"));
+        std::unique_ptr<MessageBus> client(MlmMessageBus(broker.endpoint(), "client"));
+        server->connect();
+        client->connect();
+
+        RpcServer rpc(*server, "server.queue", RpcServer::Handlers({
+            { "echo", [](const Message& request) -> UserData { return request.userData(); } },
+        }));
+
+        Message request({
+            { Message::SUBJECT, "echo" },
+            { Message::FROM, "client" },
+            { Message::TO, "server" },
+            { Message::CORRELATION_ID, "id-1" },
+        }, { "hello" });
+
+        // Synchronous.
+        Message reply = client->request("server.queue", request, 10);
+        REQUIRE(reply.metaData().at(Message::CORRELATION_ID) == "id-1");
+        REQUIRE(reply.metaData().at(Message::STATUS) == STATUS_OK);
+        REQUIRE(reply.userData() == UserData{ "hello" });
+
+        // Asynchronous.
+        std::promise<Message> asyncReply;
+        request.metaData()[Message::CORRELATION_ID] = "id-2";
+        request.metaData()[Message::REPLY_TO] = "client.replies";
+        client->sendRequest("server.queue", request, [&asyncReply](const Message& message) { asyncReply.set_value(message); });
+        auto future = asyncReply.get_future();
+        REQUIRE(future.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+        reply = future.get();
+        REQUIRE(reply.metaData().at(Message::CORRELATION_ID) == "id-2");
+        REQUIRE(reply.userData() == UserData{ "hello" });
+
+        // Nobody to reply.
+        request.metaData()[Message::TO] = "nobody";
+        request.metaData()[Message::CORRELATION_ID] = "id-3";
+        REQUIRE_THROWS_AS(client->request("server.queue", request, 1), MessageBusException);
+
+        std::cerr << "OK" << std::endl;
+    }
+}
+
+TEST_CASE("MlmMessageBus benchmark", "[.][benchmark]")
+{
+    std::cerr << " * fty_common_messagebus_malamute (benchmark): " << std::endl;
+    using namespace messagebus;
+    using Clock = std::chrono::steady_clock;
+
+    MalamuteBroker broker("inproc://malamute-benchmark");
+
+    {
+        constexpr size_t NB_MESSAGES = 100000;
+        std::promise<void> done;
+        size_t received = 0;
+
+        std::unique_ptr<MessageBus> publisher(MlmMessageBus(broker.endpoint(), "publisher"));
+        std::unique_ptr<MessageBus> subscriber(MlmMessageBus(broker.endpoint(), "subscriber"));
+        publisher->connect();
+        subscriber->connect();
+        subscriber->subscribe("metrics", [&received, &done](const Message&) {
+            if (++received == NB_MESSAGES) {
+                done.set_value();
+            }
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        auto start = Clock::now();
+        for (size_t i = 0; i < NB_MESSAGES; i++) {
+            publisher->publish("metrics", Message({}, { std::to_string(i) }));
+        }
+        REQUIRE(done.get_future().wait_for(std::chrono::seconds(60)) == std::future_status::ready);
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        std::cerr << "  - published messages: " << size_t(NB_MESSAGES / elapsed.count()) << "/s" << std::endl;
+    }
+
+    {
+        constexpr size_t NB_REQUESTS = 10000;
+
+        std::unique_ptr<MessageBus> server(MlmMessageBus(broker.endpoint(), "server"));
+        std::unique_ptr<MessageBus> client(MlmMessageBus(broker.endpoint(), "client"));
+        server->connect();
+        client->connect();
+        RpcServer rpc(*server, "server.queue", RpcServer::Handlers({
+            { "echo", [](const Message& request) -> UserData { return request.userData(); } },
+        }));
+
+        auto start = Clock::now();
+        for (size_t i = 0; i < NB_REQUESTS; i++) {
+            Message request({
+                { Message::SUBJECT, "echo" },
+                { Message::FROM, "client" },
+                { Message::TO, "server" },
+                { Message::CORRELATION_ID, std::to_string(i) },
+            }, { "hello" });
+            REQUIRE(client->request("server.queue", request, 10).userData().front() == "hello");
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        std::cerr << "  - synchronous requests: " << size_t(NB_REQUESTS / elapsed.count()) << "/s" << std::endl;
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef FTY_COMMON_MESSAGEBUS_TEST_MALAMUTE_BROKER_H_INCLUDED
+#define FTY_COMMON_MESSAGEBUS_TEST_MALAMUTE_BROKER_H_INCLUDED
+
+#include <malamute.h>
+
+#include <stdexcept>
+#include <string>
+
+/**
+ * \brief Malamute server running in the test process.
+ *
+ * The broker is an actor bound to an inproc:// or ipc:// endpoint, so that the
+ * Malamute bus can be tested without any external service. It stops when the
+ * object is destroyed, destroy the clients before.
+ */
+class MalamuteBroker {
+public:
+    explicit MalamuteBroker(const std::string& endpoint) :
+        m_endpoint(endpoint),
+        m_server(zactor_new(mlm_server, const_cast<char*>("Malamute")))
+    {
+        if (!m_server) {
+            throw std::runtime_error("Failed to start Malamute server");
+        }
+        zstr_sendx(m_server, "BIND", endpoint.c_str(), nullptr);
+    }
+
+    ~MalamuteBroker() {
+        zactor_destroy(&m_server);
+    }
+
+    MalamuteBroker(const MalamuteBroker&) = delete;
+    MalamuteBroker& operator=(const MalamuteBroker&) = delete;
+
+    const std::string& endpoint() const {
+        return m_endpoint;
+    }
+
+private:
+    std::string m_endpoint;
+    zactor_t   *m_server;
+} ;
+
+#endif
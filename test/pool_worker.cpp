@@ -4,6 +4,10 @@
 #include <iostream>
 #include <set>
 #include <numeric>
+#include <string>
+
+#include <pthread.h>
+#include <sched.h>
 
 uint64_t collatz(uint64_t i) {
     uint64_t n;
@@ -106,3 +110,584 @@ TEST_CASE("Pool worker")
         }
     }
 }
+
+TEST_CASE("Pool worker work stealing")
+{
+    std::cerr << " * fty_common_messagebus_pool_worker (work stealing): " << std::endl;
+    using namespace messagebus;
+    constexpr size_t NB_WORKERS = 16;
+    constexpr size_t NB_JOBS    = 8 * 1024;
+
+    {
+        for (size_t nWorkers = 0; nWorkers < NB_WORKERS; nWorkers = nWorkers * 2 + 1) {
+            std::cerr << "  - Collatz sequence with PoolWorker(" << nWorkers << ", WorkStealing): ";
+
+            PoolWorker                                 pool(nWorkers, PoolWorker::Scheduler::WorkStealing);
+            std::array<std::future<uint64_t>, NB_JOBS> futuresArray;
+            for (uint64_t i = 0; i < NB_JOBS; i++) {
+                futuresArray[i] = pool.schedule(collatz, i);
+            }
+
+            for (size_t i = 0; i < NB_JOBS; i++) {
+                REQUIRE(futuresArray[i].get() == collatz(i));
+            }
+
+            std::cerr << "OK" << std::endl;
+        }
+    }
+
+    {
+        for (size_t nWorkers = 1; nWorkers < NB_WORKERS; nWorkers = nWorkers * 2 + 1) {
+            std::cerr << "  - Work scheduled from workers with PoolWorker(" << nWorkers << ", WorkStealing): ";
+
+            std::vector<std::atomic_uint_fast32_t> results(NB_JOBS);
+            {
+                PoolWorker pool(nWorkers, PoolWorker::Scheduler::WorkStealing);
+                std::atomic<size_t> remaining(NB_JOBS);
+                std::promise<void> done;
+
+                // Each job schedules the next ones on the queue of its own worker, others have to steal them.
+                std::function<void(size_t, size_t)> fill = [&](size_t begin, size_t end) {
+                    if (end - begin == 1) {
+                        results[begin].store(begin);
+                        if (remaining.fetch_sub(1) == 1) {
+                            done.set_value();
+                        }
+                        return;
+                    }
+                    size_t middle = begin + (end - begin) / 2;
+                    pool.offload(fill, begin, middle);
+                    pool.offload(fill, middle, end);
+                };
+                pool.offload(fill, 0, NB_JOBS);
+                done.get_future().wait();
+            }
+
+            for (size_t i = 0; i < NB_JOBS; i++) {
+                REQUIRE(results[i].load() == i);
+            }
+
+            std::cerr << "OK" << std::endl;
+        }
+    }
+}
+
+TEST_CASE("Pool worker lock-free ring")
+{
+    std::cerr << " * fty_common_messagebus_pool_worker (lock-free ring): " << std::endl;
+    using namespace messagebus;
+    constexpr size_t NB_WORKERS = 16;
+    constexpr size_t NB_JOBS    = 8 * 1024;
+
+    for (size_t capacity : { 2, 1024 * 1024 }) {
+        for (size_t nWorkers = 1; nWorkers < NB_WORKERS; nWorkers = nWorkers * 2 + 1) {
+            std::cerr << "  - Collatz sequence with PoolWorker(" << nWorkers << ", LockFreeRing of " << capacity << "): ";
+
+            PoolWorker::Options options;
+            options.workers      = nWorkers;
+            options.scheduler    = PoolWorker::Scheduler::LockFreeRing;
+            options.ringCapacity = capacity;
+            PoolWorker pool(options);
+
+            std::array<std::future<uint64_t>, NB_JOBS> futuresArray;
+            for (uint64_t i = 0; i < NB_JOBS; i++) {
+                futuresArray[i] = pool.schedule(collatz, i);
+            }
+
+            for (size_t i = 0; i < NB_JOBS; i++) {
+                REQUIRE(futuresArray[i].get() == collatz(i));
+            }
+
+            std::cerr << "OK" << std::endl;
+        }
+    }
+
+    {
+        std::cerr << "  - Concurrent producers: ";
+
+        PoolWorker::Options options;
+        options.workers      = 4;
+        options.scheduler    = PoolWorker::Scheduler::LockFreeRing;
+        options.ringCapacity = 64;
+
+        std::atomic<size_t> done(0);
+        {
+            PoolWorker pool(options);
+            std::vector<std::thread> producers;
+            for (int producer = 0; producer < 4; producer++) {
+                producers.emplace_back([&pool, &done]() {
+                    for (size_t i = 0; i < NB_JOBS; i++) {
+                        pool.offload([&done]() { done++; });
+                    }
+                });
+            }
+            for (auto& producer : producers) {
+                producer.join();
+            }
+        }
+        REQUIRE(done == 4 * NB_JOBS);
+
+        std::cerr << "OK" << std::endl;
+    }
+}
+
+TEST_CASE("Pool worker synchronous re-entrancy")
+{
+    std::cerr << " * fty_common_messagebus_pool_worker (synchronous re-entrancy): " << std::endl;
+    using namespace messagebus;
+
+    std::cerr << "  - Work scheduling work with PoolWorker(0): ";
+
+    PoolWorker pool(0);
+    auto result = pool.schedule([&pool]() {
+        return pool.schedule([&pool]() { return pool.schedule([]() { return 42; }).get(); }).get();
+    });
+    REQUIRE(result.get() == 42);
+
+    std::cerr << "OK" << std::endl;
+}
+
+TEST_CASE("Pool worker move-only work")
+{
+    std::cerr << " * fty_common_messagebus_pool_worker (move-only work): " << std::endl;
+    using namespace messagebus;
+
+    {
+        std::cerr << "  - WorkUnit: ";
+
+        int      calls = 0;
+        WorkUnit small = [&calls]() { calls++; };
+        REQUIRE(bool(small));
+        small();
+
+        // Too big to be stored inline.
+        std::array<uint64_t, 32> big;
+        big.fill(1);
+        WorkUnit large = [&calls, big]() { calls += int(std::accumulate(big.begin(), big.end(), uint64_t(0))); };
+        WorkUnit moved = std::move(large);
+        REQUIRE(!large);
+        moved();
+        REQUIRE(calls == 33);
+
+        moved = nullptr;
+        REQUIRE(!moved);
+        REQUIRE_THROWS_AS(moved(), std::bad_function_call);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    for (size_t nWorkers = 0; nWorkers < 4; nWorkers = nWorkers * 2 + 1) {
+        std::cerr << "  - Move-only arguments with PoolWorker(" << nWorkers << "): ";
+
+        PoolWorker pool(nWorkers);
+        auto       future = pool.schedule(
+            [](std::unique_ptr<uint64_t> value) -> uint64_t {
+                return collatz(*value);
+            },
+            std::unique_ptr<uint64_t>(new uint64_t(27)));
+        REQUIRE(future.get() == 111);
+
+        // Like std::bind, a callable taking a reference gets the stored copy.
+        std::string original("copy");
+        auto appended = pool.schedule([](std::string& value) { return value.append(" done"); }, original);
+        REQUIRE(appended.get() == "copy done");
+        REQUIRE(original == "copy");
+
+        auto failure = pool.schedule([]() -> int {
+            throw std::runtime_error("failure");
+        });
+        REQUIRE_THROWS_AS(failure.get(), std::runtime_error);
+
+        std::cerr << "OK" << std::endl;
+    }
+}
+
+TEST_CASE("Pool worker bulk scheduling")
+{
+    std::cerr << " * fty_common_messagebus_pool_worker (bulk scheduling): " << std::endl;
+    using namespace messagebus;
+    constexpr size_t NB_WORKERS = 16;
+    constexpr size_t NB_JOBS    = 8 * 1024;
+
+    for (auto scheduler : {PoolWorker::Scheduler::SharedQueue, PoolWorker::Scheduler::WorkStealing}) {
+        for (size_t nWorkers = 0; nWorkers < NB_WORKERS; nWorkers = nWorkers * 2 + 1) {
+            std::cerr << "  - Batch, parallelFor and parallelReduce with PoolWorker(" << nWorkers << ", "
+                      << (scheduler == PoolWorker::Scheduler::SharedQueue ? "SharedQueue" : "WorkStealing") << "): ";
+
+            std::vector<std::atomic_uint_fast32_t> results(NB_JOBS);
+            {
+                PoolWorker            pool(nWorkers, scheduler);
+                std::vector<WorkUnit> batch;
+                for (size_t i = 0; i < NB_JOBS; i++) {
+                    batch.emplace_back([&results, i]() {
+                        results[i].store(i);
+                    });
+                }
+                pool.offloadBatch(std::move(batch));
+            }
+            for (size_t i = 0; i < NB_JOBS; i++) {
+                REQUIRE(results[i].load() == i);
+            }
+
+            PoolWorker pool(nWorkers, scheduler);
+
+            std::vector<uint64_t> collatzResults(NB_JOBS);
+            pool.parallelFor(0, NB_JOBS, 0, [&collatzResults](size_t i) {
+                collatzResults[i] = collatz(i);
+            });
+            for (size_t i = 0; i < NB_JOBS; i++) {
+                REQUIRE(collatzResults[i] == collatz(i));
+            }
+
+            for (size_t grainSize : {size_t(0), size_t(1), size_t(100), NB_JOBS * 2}) {
+                uint64_t sum = pool.parallelReduce(
+                    1, NB_JOBS + 1, grainSize, uint64_t(0),
+                    [](uint64_t accumulator, size_t i) {
+                        return accumulator + i;
+                    },
+                    [](uint64_t a, uint64_t b) {
+                        return a + b;
+                    });
+                REQUIRE(sum == NB_JOBS * (NB_JOBS + 1) / 2);
+            }
+
+            // Nested from the workers themselves.
+            uint64_t nested = pool.parallelReduce(
+                0, 64, 1, uint64_t(0),
+                [&pool](uint64_t accumulator, size_t) {
+                    return accumulator + pool.parallelReduce(0, 64, 1, uint64_t(0),
+                        [](uint64_t a, size_t) { return a + 1; },
+                        [](uint64_t a, uint64_t b) { return a + b; });
+                },
+                [](uint64_t a, uint64_t b) {
+                    return a + b;
+                });
+            REQUIRE(nested == 64 * 64);
+
+            // bool results, each chunk written from its own worker.
+            for (size_t found : {size_t(0), NB_JOBS / 2, NB_JOBS - 1, NB_JOBS}) {
+                bool any = pool.parallelReduce(
+                    0, NB_JOBS, 1, false,
+                    [found](bool accumulator, size_t i) {
+                        return accumulator || i == found;
+                    },
+                    [](bool a, bool b) {
+                        return a || b;
+                    });
+                REQUIRE(any == (found < NB_JOBS));
+            }
+
+            REQUIRE_THROWS_AS(pool.parallelFor(0, 100, 1,
+                                  [](size_t i) {
+                                      if (i == 42) {
+                                          throw std::runtime_error("failure");
+                                      }
+                                  }),
+                std::runtime_error);
+
+            std::cerr << "OK" << std::endl;
+        }
+    }
+}
+
+TEST_CASE("Pool worker options")
+{
+    std::cerr << " * fty_common_messagebus_pool_worker (options): " << std::endl;
+    using namespace messagebus;
+
+    {
+        std::cerr << "  - Thread names and CPU affinity: ";
+
+        PoolWorker::Options options;
+        options.workers = 2;
+        options.name    = "test-pool-worker";
+        options.cpus    = {0};
+        PoolWorker pool(options);
+
+        auto future = pool.schedule([]() -> std::pair<std::string, bool> {
+            char name[16] = {};
+            pthread_getname_np(pthread_self(), name, sizeof(name));
+
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            pthread_getaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+            return {name, CPU_COUNT(&cpuSet) == 1 && CPU_ISSET(0, &cpuSet)};
+        });
+
+        auto result = future.get();
+        REQUIRE((result.first == "test-pool-wor-0" || result.first == "test-pool-wor-1"));
+        REQUIRE(result.second);
+
+        std::cerr << "OK" << std::endl;
+    }
+}
+
+TEST_CASE("Pool worker elastic")
+{
+    std::cerr << " * fty_common_messagebus_pool_worker (elastic): " << std::endl;
+    using namespace messagebus;
+
+    for (auto scheduler : { PoolWorker::Scheduler::SharedQueue, PoolWorker::Scheduler::WorkStealing, PoolWorker::Scheduler::LockFreeRing }) {
+        std::cerr << "  - Grow under load and shrink when idle (scheduler " << int(scheduler) << "): ";
+
+        PoolWorker::Options options;
+        options.workers       = 0;
+        options.maxWorkers    = 4;
+        options.scheduler     = scheduler;
+        options.growthLatency = std::chrono::milliseconds(1);
+        options.idleTimeout   = std::chrono::milliseconds(50);
+        PoolWorker pool(options);
+        REQUIRE(pool.workerCount() == 0);
+
+        // Burst of slow work.
+        std::atomic<size_t> peak(0);
+        std::vector<std::future<int>> futures;
+        for (int i = 0; i < 32; i++) {
+            futures.push_back(pool.schedule([&pool, &peak](int value) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                size_t count = pool.workerCount();
+                size_t current = peak.load();
+                while (count > current && !peak.compare_exchange_weak(current, count)) {
+                }
+                return value;
+            }, i));
+        }
+        for (int i = 0; i < 32; i++) {
+            REQUIRE(futures[i].get() == i);
+        }
+        REQUIRE(peak.load() > 1);
+        REQUIRE(peak.load() <= 4);
+
+        // Idle, the pool shrinks back.
+        for (int retry = 0; retry < 100 && pool.workerCount(); retry++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        REQUIRE(pool.workerCount() == 0);
+
+        // And grows again.
+        REQUIRE(pool.schedule([]() { return 42; }).get() == 42);
+        REQUIRE(pool.workerCount() >= 1);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - Grow while all the workers are stuck in long jobs: ";
+
+        PoolWorker::Options options;
+        options.workers       = 2;
+        options.maxWorkers    = 4;
+        options.growthLatency = std::chrono::milliseconds(1);
+        PoolWorker pool(options);
+
+        std::promise<void> release;
+        std::shared_future<void> released = release.get_future().share();
+        std::atomic<size_t> started(0);
+        std::vector<std::future<void>> blocked;
+        for (size_t i = 0; i < options.workers; i++) {
+            blocked.push_back(pool.schedule([released, &started]() {
+                started++;
+                released.wait();
+            }));
+        }
+        while (started.load() < options.workers) {
+            std::this_thread::yield();
+        }
+
+        // Queued before growthLatency, nothing else is scheduled and no job ends afterwards.
+        auto queued = pool.schedule([]() { return 42; });
+        REQUIRE(queued.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+        REQUIRE(queued.get() == 42);
+        REQUIRE(pool.workerCount() > options.workers);
+        for (auto& future : blocked) {
+            REQUIRE(future.wait_for(std::chrono::seconds(0)) == std::future_status::timeout);
+        }
+
+        release.set_value();
+        for (auto& future : blocked) {
+            future.get();
+        }
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - Keep the minimum number of workers: ";
+
+        PoolWorker::Options options;
+        options.workers     = 2;
+        options.maxWorkers  = 8;
+        options.idleTimeout = std::chrono::milliseconds(10);
+        PoolWorker pool(options);
+        REQUIRE(pool.workerCount() == 2);
+
+        pool.parallelFor(0, 1000, 1, [](size_t) { std::this_thread::sleep_for(std::chrono::microseconds(100)); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        REQUIRE(pool.workerCount() == 2);
+
+        std::cerr << "OK" << std::endl;
+    }
+}
+
+TEST_CASE("Pool worker statistics")
+{
+    std::cerr << " * fty_common_messagebus_pool_worker (statistics): " << std::endl;
+    using namespace messagebus;
+
+    {
+        std::cerr << "  - Histogram percentiles: ";
+
+        PoolWorker::Histogram histogram;
+        REQUIRE(histogram.percentile(50) == std::chrono::nanoseconds(0));
+
+        histogram.buckets[0] = 90;
+        histogram.buckets[4] = 9;
+        histogram.buckets[PoolWorker::Histogram::BUCKETS - 1] = 1;
+        histogram.count = 100;
+        histogram.max   = std::chrono::seconds(20);
+        REQUIRE(histogram.percentile(50) == std::chrono::microseconds(1));
+        REQUIRE(histogram.percentile(95) == std::chrono::microseconds(16));
+        REQUIRE(histogram.percentile(100) == std::chrono::seconds(20));
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    for (size_t workers : { 0, 4 }) {
+        std::cerr << "  - Counters and durations (" << workers << " workers): ";
+
+        PoolWorker pool(workers);
+        std::vector<std::future<void>> futures;
+        for (int i = 0; i < 20; i++) {
+            futures.push_back(pool.schedule([]() { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }));
+        }
+        for (auto& future : futures) {
+            future.wait();
+        }
+
+        // Statistics of a job are recorded right after the job, which is after its future is ready.
+        auto stats = pool.stats();
+        for (int retry = 0; retry < 100 && stats.completed != 20; retry++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            stats = pool.stats();
+        }
+
+        REQUIRE(stats.workers == workers);
+        if (stats.enabled) {
+            REQUIRE(stats.scheduled == 20);
+            REQUIRE(stats.completed == 20);
+            REQUIRE(stats.queueDepth == 0);
+            REQUIRE((workers ? stats.maxQueueDepth >= 1 : stats.maxQueueDepth == 0));
+            REQUIRE(stats.runTime.count == 20);
+            REQUIRE(stats.waitTime.count == 20);
+            REQUIRE(stats.runTime.total >= std::chrono::milliseconds(20));
+            REQUIRE(stats.runTime.max >= std::chrono::milliseconds(1));
+            REQUIRE(stats.runTime.percentile(50) >= std::chrono::milliseconds(1));
+            REQUIRE(std::accumulate(stats.runTime.buckets.begin(), stats.runTime.buckets.end(), uint64_t(0)) == 20);
+        }
+
+        std::cerr << "OK" << std::endl;
+    }
+}
+
+TEST_CASE("Pool worker urgency")
+{
+    std::cerr << " * fty_common_messagebus_pool_worker (urgency): " << std::endl;
+    using namespace messagebus;
+    using Clock = PoolWorker::Urgency::Clock;
+
+    {
+        std::cerr << "  - Priorities and deadlines: ";
+
+        PoolWorker pool(1);
+
+        // Hold the only worker while queueing work.
+        std::promise<void> started;
+        std::promise<void> release;
+        auto blocker = release.get_future().share();
+        pool.offload([&started, blocker]() {
+            started.set_value();
+            blocker.wait();
+        });
+        started.get_future().wait();
+
+        std::mutex       mutex;
+        std::vector<int> order;
+        auto record = [&mutex, &order](int value) {
+            std::unique_lock<std::mutex> lk(mutex);
+            order.push_back(value);
+        };
+
+        auto last = pool.schedule(record, 0);
+        pool.offload(PoolWorker::Urgency(-1000), record, 1);
+        pool.offload(PoolWorker::Urgency(1), record, 2);
+        pool.offload(PoolWorker::Urgency(1000), record, 3);
+        pool.offload(Clock::now() - std::chrono::hours(1), record, 4);
+        pool.offload(PoolWorker::Urgency(0), record, 5);
+
+        release.set_value();
+        last.wait();
+
+        // Earliest virtual deadline first, work queued without urgency comes after urgent work.
+        std::unique_lock<std::mutex> lk(mutex);
+        REQUIRE(order == std::vector<int>({4, 3, 2, 5, 1, 0}));
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - Discard expired work: ";
+
+        PoolWorker pool(1);
+
+        std::promise<void> started;
+        std::promise<void> release;
+        auto blocker = release.get_future().share();
+        pool.offload([&started, blocker]() {
+            started.set_value();
+            blocker.wait();
+        });
+        started.get_future().wait();
+
+        std::atomic<int> done(0);
+        auto expired = pool.schedule(PoolWorker::Urgency(Clock::now() + std::chrono::milliseconds(1), true), [&done]() { return ++done; });
+        auto kept    = pool.schedule(PoolWorker::Urgency(Clock::now() + std::chrono::milliseconds(1)), [&done]() { return ++done; });
+        pool.offload(PoolWorker::Urgency(Clock::now() + std::chrono::milliseconds(1), true), [&done]() { ++done; });
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        release.set_value();
+
+        REQUIRE_THROWS_AS(expired.get(), PoolWorker::ExpiredException);
+        REQUIRE(kept.get() == 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        REQUIRE(done == 1);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - Urgent work doesn't starve other work: ";
+
+        PoolWorker pool(1);
+
+        std::promise<void> started;
+        std::promise<void> release;
+        auto blocker = release.get_future().share();
+        pool.offload([&started, blocker]() {
+            started.set_value();
+            blocker.wait();
+        });
+        started.get_future().wait();
+
+        std::atomic<int> urgentDone(0);
+        std::atomic<int> urgentDoneBeforeOther(-1);
+        auto other = pool.schedule([&]() { urgentDoneBeforeOther = urgentDone.load(); });
+        for (int i = 0; i < 100; i++) {
+            pool.offload(PoolWorker::Urgency(10), [&urgentDone]() { urgentDone++; });
+        }
+
+        release.set_value();
+        other.wait();
+        REQUIRE(urgentDoneBeforeOther.load() < 100);
+
+        std::cerr << "OK" << std::endl;
+    }
+}
@@ -0,0 +1,155 @@
+#include "fty_common_messagebus_rpc_server.h"
+#include <catch2/catch.hpp>
+
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+using namespace messagebus;
+
+// Bus keeping the listener of one queue, and the replies sent.
+class ReplyRecorder : public MessageBus {
+public:
+    void connect() override { }
+    void publish(const std::string&, const Message&) override { }
+    void publish(const std::string&, const Message&, SendCompletion) override { }
+    SubscriptionHandle subscribe(const std::string&, MessageListener) override { return 0; }
+    void unsubscribe(const std::string&, MessageListener) override { }
+    void unsubscribe(SubscriptionHandle handle) override {
+        REQUIRE(handle == 42);
+        listener = nullptr;
+    }
+    void sendRequest(const std::string&, const Message&) override { }
+    void sendRequest(const std::string&, const Message&, SendCompletion) override { }
+    void sendRequest(const std::string&, const Message&, MessageListener) override { }
+    void sendReply(const std::string& replyQueue, const Message& message) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        replies.emplace_back(replyQueue, message);
+        cv.notify_all();
+    }
+    void sendReply(const std::string& replyQueue, const Message& message, SendCompletion) override {
+        sendReply(replyQueue, message);
+    }
+    SubscriptionHandle receive(const std::string& queue, MessageListener messageListener) override {
+        REQUIRE(queue == "rpc.queue");
+        listener = messageListener;
+        return 42;
+    }
+    void setPriority(const std::string&, Priority) override { }
+    Message request(const std::string&, const Message&, int) override { return Message(); }
+
+    void waitReplies(size_t count) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this, count]() { return replies.size() >= count; });
+    }
+
+    MessageListener listener;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::pair<std::string, Message>> replies;
+} ;
+
+Message makeRequest(const std::string& subject, const std::string& correlationId, const std::string& payload) {
+    return Message({
+        { Message::SUBJECT, subject },
+        { Message::FROM, "client" },
+        { Message::REPLY_TO, "client.replies" },
+        { Message::CORRELATION_ID, correlationId },
+    }, { payload });
+}
+
+RpcServer::Handlers makeHandlers() {
+    return RpcServer::Handlers({
+        { "double", [](const Message& request) -> UserData {
+            return { std::to_string(2 * std::stoi(request.userData().front())) };
+        }},
+        { "fail", [](const Message&) -> UserData { throw std::runtime_error("failed on purpose"); }},
+        { "empty", [](const Message&) -> UserData { throw std::bad_function_call(); }},
+    });
+}
+
+}
+
+TEST_CASE("RpcServer")
+{
+    std::cerr << " * fty_common_messagebus_rpc_server: " << std::endl;
+
+    {
+        std::cerr << "  - Replies in the thread of the bus: ";
+
+        ReplyRecorder bus;
+        {
+            RpcServer server(bus, "rpc.queue", makeHandlers());
+            REQUIRE(bus.listener);
+
+            bus.listener(makeRequest("double", "id-1", "21"));
+            bus.listener(makeRequest("fail", "id-2", ""));
+            bus.listener(makeRequest("unknown", "id-3", ""));
+            bus.listener(makeRequest("empty", "id-4", ""));
+            bus.listener(Message({ { Message::SUBJECT, "double" } }, { "1" }));
+            bus.listener(Message({
+                { Message::SUBJECT, "double" },
+                { Message::REPLY_TO, "client.replies" },
+                { Message::CORRELATION_ID, "id-5" },
+            }, { "1" }));
+
+            REQUIRE(bus.replies.size() == 4);
+
+            const auto& ok = bus.replies[0];
+            REQUIRE(ok.first == "client.replies");
+            REQUIRE(ok.second.metaData().at(Message::SUBJECT) == "double");
+            REQUIRE(ok.second.metaData().at(Message::TO) == "client");
+            REQUIRE(ok.second.metaData().at(Message::CORRELATION_ID) == "id-1");
+            REQUIRE(ok.second.metaData().at(Message::STATUS) == STATUS_OK);
+            REQUIRE(ok.second.userData() == UserData{ "42" });
+
+            const auto& failed = bus.replies[1].second;
+            REQUIRE(failed.isOnError());
+            REQUIRE(failed.metaData().at(Message::CORRELATION_ID) == "id-2");
+            REQUIRE(failed.userData() == UserData{ "failed on purpose" });
+
+            const auto& unknown = bus.replies[2].second;
+            REQUIRE(unknown.isOnError());
+            REQUIRE(unknown.metaData().at(Message::CORRELATION_ID) == "id-3");
+            REQUIRE(unknown.userData() == UserData{ "Unknown subject 'unknown'" });
+
+            const auto& empty = bus.replies[3].second;
+            REQUIRE(empty.isOnError());
+            REQUIRE(empty.metaData().at(Message::CORRELATION_ID) == "id-4");
+            REQUIRE(empty.userData() != UserData{ "Unknown subject 'empty'" });
+        }
+        REQUIRE(!bus.listener);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - Replies from a PoolWorker: ";
+
+        constexpr size_t NB_REQUESTS = 1000;
+        ReplyRecorder bus;
+        PoolWorker pool(4);
+        RpcServer server(bus, "rpc.queue", makeHandlers(), &pool);
+
+        for (size_t i = 0; i < NB_REQUESTS; i++) {
+            bus.listener(makeRequest("double", std::to_string(i), std::to_string(i)));
+        }
+        bus.waitReplies(NB_REQUESTS);
+
+        std::vector<bool> seen(NB_REQUESTS, false);
+        for (const auto& reply : bus.replies) {
+            size_t id = std::stoul(reply.second.metaData().at(Message::CORRELATION_ID));
+            REQUIRE(id < NB_REQUESTS);
+            REQUIRE(!seen[id]);
+            seen[id] = true;
+            REQUIRE(reply.second.userData() == UserData{ std::to_string(2 * id) });
+        }
+
+        std::cerr << "OK" << std::endl;
+    }
+}
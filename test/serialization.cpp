@@ -0,0 +1,195 @@
+#include "fty_common_messagebus_serialization.h"
+#include "fty_common_messagebus_dto.h"
+#include <catch2/catch.hpp>
+
+#include <iostream>
+#include <limits>
+
+namespace {
+
+enum class Unit : uint8_t { None, Watt, Celsius };
+
+struct Sample {
+    uint64_t timestamp = 0;
+    double   value = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&Sample::timestamp, &Sample::value);
+    }
+};
+
+struct Metric {
+    std::string                        name;
+    Unit                               unit = Unit::None;
+    int32_t                            offset = 0;
+    float                              scale = 1;
+    bool                               valid = false;
+    std::vector<Sample>                samples;
+    std::map<std::string, std::string> labels;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&Metric::name, &Metric::unit, &Metric::offset, &Metric::scale, &Metric::valid, &Metric::samples, &Metric::labels);
+    }
+};
+
+// Metric before samples and labels were added.
+struct MetricV1 {
+    std::string name;
+    Unit        unit = Unit::None;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&MetricV1::name, &MetricV1::unit);
+    }
+};
+
+struct Limits {
+    int8_t   smallest = 0;
+    int64_t  lowest = 0;
+    int64_t  highest = 0;
+    uint64_t largest = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&Limits::smallest, &Limits::lowest, &Limits::highest, &Limits::largest);
+    }
+};
+
+struct Wide {
+    uint64_t value = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&Wide::value);
+    }
+};
+
+struct Narrow {
+    uint8_t value = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&Narrow::value);
+    }
+};
+
+}
+
+TEST_CASE("Serialization")
+{
+    std::cerr << " * fty_common_messagebus_serialization: " << std::endl;
+    using namespace messagebus;
+
+    {
+        std::cerr << "  - round trips: ";
+
+        Metric metric;
+        metric.name = "realpower.default";
+        metric.unit = Unit::Watt;
+        metric.offset = -3;
+        metric.scale = 0.5f;
+        metric.valid = true;
+        for (uint64_t i = 0; i < 100; i++) {
+            metric.samples.push_back(Sample{ 1600000000 + i, double(i) / 3 });
+        }
+        metric.labels = { { "asset", "ups-1" }, { "phase", "L1" } };
+
+        std::string frame = encode(metric);
+        REQUIRE(frame.size() == BinaryCodec<Metric>::fieldsSize(metric));
+
+        Metric decoded = decode<Metric>(frame);
+        REQUIRE(decoded.name == metric.name);
+        REQUIRE(decoded.unit == Unit::Watt);
+        REQUIRE(decoded.offset == -3);
+        REQUIRE(decoded.scale == 0.5f);
+        REQUIRE(decoded.valid);
+        REQUIRE(decoded.samples.size() == metric.samples.size());
+        for (size_t i = 0; i < metric.samples.size(); i++) {
+            REQUIRE(decoded.samples[i].timestamp == metric.samples[i].timestamp);
+            REQUIRE(decoded.samples[i].value == metric.samples[i].value);
+        }
+        REQUIRE(decoded.labels == metric.labels);
+
+        Limits limits{ std::numeric_limits<int8_t>::min(), std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max(), std::numeric_limits<uint64_t>::max() };
+        Limits decodedLimits = decode<Limits>(encode(limits));
+        REQUIRE(decodedLimits.smallest == limits.smallest);
+        REQUIRE(decodedLimits.lowest == limits.lowest);
+        REQUIRE(decodedLimits.highest == limits.highest);
+        REQUIRE(decodedLimits.largest == limits.largest);
+
+        // Small values take a byte, whatever their type.
+        REQUIRE(encode(Limits{ -1, 1, -64, 127 }).size() == 4);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - appended fields: ";
+
+        Metric metric;
+        metric.name = "temperature";
+        metric.unit = Unit::Celsius;
+        metric.samples.push_back(Sample{ 1, 2 });
+
+        // Old readers skip the new fields.
+        MetricV1 old = decode<MetricV1>(encode(metric));
+        REQUIRE(old.name == "temperature");
+        REQUIRE(old.unit == Unit::Celsius);
+
+        // New readers keep their values for the fields old writers don't know.
+        Metric current;
+        current.scale = 2;
+        decode(encode(old), current);
+        REQUIRE(current.name == "temperature");
+        REQUIRE(current.scale == 2);
+        REQUIRE(current.samples.empty());
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - malformed frames: ";
+
+        Metric metric;
+        metric.name = "voltage";
+        metric.samples.push_back(Sample{ 1, 2 });
+        std::string frame = encode(metric);
+
+        Metric decoded;
+        // Cut inside the name.
+        REQUIRE_THROWS_AS(decode(std::string_view(frame).substr(0, 3), decoded), MessageBusException);
+        // Cut inside the samples.
+        REQUIRE_THROWS_AS(decode(std::string_view(frame).substr(0, frame.size() - 3), decoded), MessageBusException);
+        // Unterminated varint.
+        REQUIRE_THROWS_AS(decode<Limits>(std::string(11, '\xff')), MessageBusException);
+        // Out of range for the field.
+        REQUIRE(decode<Narrow>(encode(Wide{ 255 })).value == 255);
+        REQUIRE_THROWS_AS(decode<Narrow>(encode(Wide{ 256 })), MessageBusException);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - FooBar in user data: ";
+
+        // Two string frames each, as peers built before the binary encoding expect.
+        UserData data;
+        data << FooBar("doAction", "wait");
+        data << FooBar("status", "ok");
+        REQUIRE(data == UserData{ "doAction", "wait", "status", "ok" });
+
+        FooBar first, second;
+        data >> first;
+        data >> second;
+        REQUIRE(data.empty());
+        REQUIRE(first.foo == "doAction");
+        REQUIRE(first.bar == "wait");
+        REQUIRE(second.foo == "status");
+        REQUIRE(second.bar == "ok");
+
+        // One binary frame when asked for explicitly.
+        data.push_back(encode(FooBar("doAction", "wait")));
+        REQUIRE(data.size() == 1);
+        FooBar binary = decode<FooBar>(data.front());
+        REQUIRE(binary.foo == "doAction");
+        REQUIRE(binary.bar == "wait");
+
+        std::cerr << "OK" << std::endl;
+    }
+}
@@ -0,0 +1,202 @@
+#include "fty_common_messagebus_interface.h"
+#include "fty_common_messagebus_message.h"
+#include "fty_common_messagebus_exception.h"
+#include "fty_common_messagebus_rpc_server.h"
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+bool segmentExists(const std::string& endpoint, const std::string& kind, const std::string& name) {
+    return access(("/dev/shm/fty-messagebus-" + endpoint + "-" + kind + "-" + name).c_str(), F_OK) == 0;
+}
+
+// Topic segments are kept after the buses are destroyed, remove the ones of the test.
+void removeSegments(const std::string& endpoint) {
+    const std::string prefix = "fty-messagebus-" + endpoint + "-";
+    if (DIR *dir = opendir("/dev/shm")) {
+        while (dirent *entry = readdir(dir)) {
+            std::string name(entry->d_name);
+            if (name.compare(0, prefix.size(), prefix) == 0) {
+                shm_unlink(("/" + name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+}
+
+}
+
+TEST_CASE("SharedMemoryMessageBus")
+{
+    std::cerr << " * fty_common_messagebus_shared_memory: " << std::endl;
+    using namespace messagebus;
+
+    const std::string endpoint = "test-" + std::to_string(getpid());
+    removeSegments(endpoint);
+
+    {
+        std::cerr << "  - topics: ";
+
+        constexpr size_t NB_MESSAGES = 1000;
+        std::vector<std::string> received[2];
+        std::promise<void> done[2];
+        std::atomic<size_t> strays(0);
+
+        // Declared after the state of their listeners, to be destroyed before it.
+        std::unique_ptr<MessageBus> publisher(SharedMemoryMessageBus(endpoint, "publisher"));
+        std::unique_ptr<MessageBus> first(SharedMemoryMessageBus(endpoint, "first"));
+        std::unique_ptr<MessageBus> second(SharedMemoryMessageBus(endpoint, "second"));
+        std::unique_ptr<MessageBus> elsewhere(SharedMemoryMessageBus(endpoint + "-elsewhere", "first"));
+        publisher->connect();
+        first->connect();
+        second->connect();
+        elsewhere->connect();
+
+        for (size_t i = 0; i < 2; i++) {
+            (i ? second : first)->subscribe("metrics", [&received, &done, i](const Message& message) {
+                received[i].push_back(message.userData().front());
+                if (received[i].size() == NB_MESSAGES) {
+                    done[i].set_value();
+                }
+            });
+        }
+        elsewhere->subscribe("metrics", [&strays](const Message&) { strays++; });
+
+        std::atomic<size_t> completed(0);
+        for (size_t i = 0; i < NB_MESSAGES; i++) {
+            publisher->publish("metrics", Message({ { "index", std::to_string(i) } }, { std::to_string(i) }), [&completed](bool sent) {
+                if (sent) {
+                    completed++;
+                }
+            });
+        }
+        for (size_t i = 0; i < 2; i++) {
+            REQUIRE(done[i].get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+            for (size_t j = 0; j < NB_MESSAGES; j++) {
+                REQUIRE(received[i][j] == std::to_string(j));
+            }
+        }
+        REQUIRE(strays == 0);
+
+        // Completions are called from the receiver thread of the publisher.
+        std::promise<void> flushed;
+        publisher->publish("metrics", Message({}, { "flush" }), [&flushed](bool) { flushed.set_value(); });
+        flushed.get_future().wait();
+        REQUIRE(completed == NB_MESSAGES);
+
+        REQUIRE_THROWS_AS(std::unique_ptr<MessageBus>(SharedMemoryMessageBus(endpoint, "first"))->connect(), MessageBusException);
+        REQUIRE_THROWS_AS(publisher->publish("metrics", Message({}, { std::string(1 << 20, 'x') })), MessageBusException);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - requests and replies: ";
+
+        std::unique_ptr<MessageBus> server(SharedMemoryMessageBus(endpoint, "server"));
+        std::unique_ptr<MessageBus> client(SharedMemoryMessageBus(endpoint, "client"));
+        server->connect();
+        client->connect();
+
+        RpcServer rpc(*server, "server.queue", RpcServer::Handlers({
+            { "echo", [](const Message& request) -> UserData { return request.userData(); } },
+        }));
+
+        Message request({
+            { Message::SUBJECT, "echo" },
+            { Message::FROM, "client" },
+            { Message::TO, "server" },
+            { Message::CORRELATION_ID, "id-1" },
+        }, { "hello", "" });
+
+        // Synchronous.
+        Message reply = client->request("server.queue", request, 10);
+        REQUIRE(reply.metaData().at(Message::CORRELATION_ID) == "id-1");
+        REQUIRE(reply.metaData().at(Message::STATUS) == STATUS_OK);
+        REQUIRE(reply.userData() == UserData{ "hello", "" });
+
+        // Asynchronous.
+        std::promise<Message> asyncReply;
+        request.metaData()[Message::CORRELATION_ID] = "id-2";
+        request.metaData()[Message::REPLY_TO] = "client.replies";
+        client->sendRequest("server.queue", request, [&asyncReply](const Message& message) { asyncReply.set_value(message); });
+        auto future = asyncReply.get_future();
+        REQUIRE(future.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+        reply = future.get();
+        REQUIRE(reply.metaData().at(Message::CORRELATION_ID) == "id-2");
+        REQUIRE(reply.userData() == UserData{ "hello", "" });
+
+        // Nobody reads the mailbox.
+        request.metaData()[Message::TO] = "nobody";
+        REQUIRE_THROWS_AS(client->request("server.queue", request, 1), MessageBusException);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - mailboxes only exist while their owner is connected: ";
+
+        std::unique_ptr<MessageBus> sender(SharedMemoryMessageBus(endpoint, "sender"));
+        sender->connect();
+
+        // Nothing is created for a client not connected.
+        std::promise<bool> dropped;
+        sender->sendRequest("late.queue", Message({ { Message::TO, "late" } }, { "dropped" }), [&dropped](bool sent) { dropped.set_value(sent); });
+        REQUIRE(!dropped.get_future().get());
+        REQUIRE(!segmentExists(endpoint, "mailbox", "late"));
+
+        for (int connection = 0; connection < 2; connection++) {
+            std::vector<std::string> received;
+            std::promise<void> done;
+            std::unique_ptr<MessageBus> late(SharedMemoryMessageBus(endpoint, "late", 4096));
+            late->receive("late.queue", [&received, &done](const Message& message) {
+                received.push_back(message.userData().front());
+                if (received.size() == 3) {
+                    done.set_value();
+                }
+            });
+            late->connect();
+            REQUIRE(segmentExists(endpoint, "mailbox", "late"));
+
+            // The mailbox of the previous connection was closed, the sender finds the new one.
+            for (int i = 0; i < 3; i++) {
+                sender->sendRequest("late.queue", Message({ { Message::TO, "late" } }, { std::to_string(i) }));
+            }
+            REQUIRE(done.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+            REQUIRE(received == std::vector<std::string>{ "0", "1", "2" });
+
+            late.reset();
+            REQUIRE(!segmentExists(endpoint, "mailbox", "late"));
+        }
+
+        // The mailbox of a client which crashed is reaped by the next one connecting.
+        pid_t child = fork();
+        if (child == 0) {
+            MessageBus *crashed = SharedMemoryMessageBus(endpoint, "crashed");
+            crashed->connect();
+            _exit(0);
+        }
+        int status;
+        REQUIRE(waitpid(child, &status, 0) == child);
+        REQUIRE(segmentExists(endpoint, "mailbox", "crashed"));
+        std::unique_ptr<MessageBus> next(SharedMemoryMessageBus(endpoint, "next"));
+        next->connect();
+        REQUIRE(!segmentExists(endpoint, "mailbox", "crashed"));
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    removeSegments(endpoint);
+    removeSegments(endpoint + "-elsewhere");
+}
@@ -0,0 +1,119 @@
+#include "fty_common_messagebus_strand.h"
+#include <catch2/catch.hpp>
+
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+TEST_CASE("Strand")
+{
+    std::cerr << " * fty_common_messagebus_strand: " << std::endl;
+    using namespace messagebus;
+    constexpr size_t NB_STRANDS = 64;
+    constexpr size_t NB_JOBS    = 1000;
+
+    {
+        std::cerr << "  - Serialized and ordered execution: ";
+
+        PoolWorker pool(4);
+        std::vector<std::unique_ptr<Strand>> strands;
+        for (size_t i = 0; i < NB_STRANDS; i++) {
+            strands.emplace_back(new Strand(pool));
+        }
+
+        // Unsynchronized state per strand, only safe if jobs of a strand never overlap.
+        struct Stream {
+            std::vector<size_t> order;
+            size_t              running = 0;
+            size_t              overlaps = 0;
+            size_t              outside = 0;
+        } ;
+        std::vector<Stream> streams(NB_STRANDS);
+
+        std::vector<std::future<void>> lasts;
+        for (size_t job = 0; job < NB_JOBS; job++) {
+            for (size_t i = 0; i < NB_STRANDS; i++) {
+                auto& stream = streams[i];
+                auto& strand = *strands[i];
+                auto  work   = [&stream, &strand, job]() {
+                    if (stream.running++) {
+                        stream.overlaps++;
+                    }
+                    if (!strand.runningInThisThread()) {
+                        stream.outside++;
+                    }
+                    stream.order.push_back(job);
+                    stream.running--;
+                };
+                if (job == NB_JOBS - 1) {
+                    lasts.push_back(strand.schedule(work));
+                }
+                else {
+                    strand.offload(work);
+                }
+            }
+        }
+        for (auto& last : lasts) {
+            last.get();
+        }
+
+        for (const auto& stream : streams) {
+            REQUIRE(stream.overlaps == 0);
+            REQUIRE(stream.outside == 0);
+            REQUIRE(stream.order.size() == NB_JOBS);
+            for (size_t job = 0; job < NB_JOBS; job++) {
+                REQUIRE(stream.order[job] == job);
+            }
+        }
+        REQUIRE(!strands[0]->runningInThisThread());
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - Strands run in parallel: ";
+
+        PoolWorker pool(2);
+        Strand first(pool);
+        Strand second(pool);
+
+        // Each strand waits for the other one, which deadlocks if they are serialized together.
+        std::promise<void> firstStarted;
+        std::promise<void> secondStarted;
+        auto a = first.schedule([&]() {
+            firstStarted.set_value();
+            secondStarted.get_future().wait();
+        });
+        auto b = second.schedule([&]() {
+            secondStarted.set_value();
+            firstStarted.get_future().wait();
+        });
+        REQUIRE(a.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+        REQUIRE(b.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+
+        std::cerr << "OK" << std::endl;
+    }
+
+    {
+        std::cerr << "  - Nested posts and destroyed strands: ";
+
+        PoolWorker pool(4);
+        std::atomic<size_t> done(0);
+        std::promise<size_t> result;
+        {
+            Strand strand(pool);
+            auto posted = strand.schedule([&strand, &done, &result]() {
+                for (size_t i = 0; i < 100; i++) {
+                    strand.offload([&done]() { done++; });
+                }
+                strand.offload([&done, &result]() { result.set_value(done.load()); });
+            });
+            posted.get();
+        }
+
+        // Work posted before the strand was destroyed still runs, in order.
+        REQUIRE(result.get_future().get() == 100);
+
+        std::cerr << "OK" << std::endl;
+    }
+}